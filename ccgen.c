@@ -5,10 +5,31 @@
   :::Synopsis:::
   ccgen [-l logfile]
         [-x backend]
+        [-j jobs]
+        [--max-load load] [--max-pressure percent]
+        [--mem-limit size] [--history file]
+        [--timeout seconds]
+        [--fail-fast | --keep-going]
+        [--shard k/n [--shard-mode mode]]
+        [--cache-dir dir [--cache-max-size size]]
+        [--deps] [--if-changed]
+        [--dedup-commands] [--dedup-outputs mode]
+        [--preprocess-once | --pch header]
+        [--stream] [--dry-run]
+        [--response-file mode]
         [-b outfile_base]
 	[-e extension]
 	[-o option_spec]... [args]...
 
+  ccgen [-x backend] [-b outfile_base] [-e extension]
+	[-o option_spec]... --emit-plan plan [args]...
+
+  ccgen [options]... --run-plan plan
+
+  ccgen [--cache-dir dir] --cache-stats
+
+  ccgen [--cache-dir dir] [--cache-max-size size] --daemon
+
   ccgen -h
 
   ccgen -v
@@ -29,6 +50,195 @@
       Choose backend, which _ccgen_ will run and pass options and arguments to.
       Defaults to _cc_.
 
+  -j jobs
+      Run at most _jobs_ backend processes at once.
+      Defaults to the number of online processors.
+
+      When run under GNU make, _ccgen_ joins the jobserver of make
+      (--jobserver-auth= in MAKEFLAGS) and takes a token for every backend
+      but the first one. Otherwise it starts its own jobserver with _jobs_
+      tokens and offers it to the backends, so that nested jobserver clients
+      (make, -flto=jobserver) share the same budget.
+
+  --max-load load
+  --max-pressure percent
+      Adapt the number of running backends (up to _jobs_) at runtime,
+      so that 1-minute load average of the system stays under _load_,
+      and pressure stall information (avg10 of "some" line of /proc/pressure/cpu,
+      memory and io, whichever is the highest) stays under _percent_.
+      Backends are started one by one, and their number grows by one per
+      second while the system is below the target, and is halved above it.
+
+  --mem-limit size
+      Start a backend only if the peak memory it's predicted to use, together
+      with the predictions for the running ones, fits into _size_ (with optional
+      K, M, G or T suffix). Peak RSS of every finished backend is measured;
+      the prediction is the one recorded for the same command in the history
+      file, or the largest peak seen so far in this run (the whole _size_,
+      until there is nothing seen). A backend is always started if nothing
+      else is running.
+
+  --history file
+      Load measurements of previous runs from _file_, and save them there
+      when the run is over.
+
+  --timeout seconds
+      Give every backend at most _seconds_ to finish. Every backend runs in
+      its own process group; when the time is up, the group gets SIGTERM,
+      and SIGKILL a few seconds later. The variant is reported as timed out,
+      the rest of the combinations are run as usual.
+
+  --fail-fast
+      After the first failed (or timed out) variant, start no more backends,
+      and cancel the running ones the same way as timed out ones are killed.
+
+  --keep-going
+      Run all of the combinations, no matter how many of them fail. This is
+      the default, the option only makes it explicit. Can't be used together
+      with --fail-fast.
+
+  --shard k/n
+      Run only the _k_-th (starting from 1) of _n_ slices of the combinations,
+      so that _n_ instances of _ccgen_ (say, on different hosts) run the whole
+      matrix together.
+
+  --shard-mode mode
+      How the combinations are sliced. _contiguous_ (the default) gives every
+      shard a run of consecutive combinations, _strided_ gives the _k_-th shard
+      every _n_-th combination starting from the _k_-th one. _balanced_ is
+      like _contiguous_, but the slices have equal total runtime according to
+      --history (unknown commands are taken for an average one); all of the
+      shards must use the same history file.
+
+  --cache-dir dir
+      Keep the outputs of backends in _dir_ (CCGEN_CACHE_DIR by default),
+      and take them from there instead of running a backend, if neither the
+      backend executable, nor the command (but for the output file name),
+      nor the contents of the arguments, which are files, have changed since.
+      Only works together with -b.
+
+      For a compiler backend (its name contains "cc", "++" or "clang"),
+      the programs it runs (cc1, cc1plus, as, collect2, ld, as told by
+      -print-prog-name) are taken into account as well. Their hashes are
+      kept in _dir_/toolchain along with the inode, size and modification
+      time of every program, which are rehashed only when these change.
+
+      So are the headers the sources include: the sources are
+      preprocessed (with -E, once for every preprocessor configuration, or
+      the ones made by --preprocess-once are taken), and the output is hashed.
+
+  --cache-max-size size
+      When the run is over, evict least recently used entries in the
+      background, until the cache takes less than _size_ (with optional
+      K, M, G or T suffix). Access times are kept in _dir_/index.
+
+  --cache-stats
+      Print the number of cache hits, misses and evictions, and the
+      number and total size of entries in the cache, then exit.
+
+  --daemon
+      Serve the cache in _dir_ to the runs of _ccgen_ on the same host,
+      until SIGINT or SIGTERM. The daemon keeps the index in memory, saves
+      it (with the statistics) every minute and on exit, and evicts entries
+      itself, if --cache-max-size is given. Runs, which find _dir_/daemon.sock,
+      ask the daemon instead of locking the index; when the same command is
+      being run by another run already, they wait for its output instead of
+      running it once more. Without the daemon (or if it's gone) the cache
+      is used as usual.
+
+  --deps
+      Pass "-MD -MF output.d" to the backend, so that it writes the
+      dependencies of every output file next to it, and skip the combinations
+      whose output is newer than all of the dependencies (headers included)
+      recorded by the previous run. Only works together with -b.
+      With --cache-dir, the depfile is cached and restored along with the
+      output.
+
+  --if-changed
+      Skip the combinations whose output is newer than all of the arguments,
+      which are files, and was made by the same command. A hash of the
+      command is kept next to every output file in output.cmd.
+      Only works together with -b, may be combined with --deps.
+
+  --dedup-commands
+      Run the backend only once for the combinations, whose commands are
+      the same but for the output file name (say, because of empty fnames),
+      and copy its output (reflinked, where the file system allows) to the
+      other output files. Only works together with -b.
+
+  --dedup-outputs mode
+      Hash every output file, as soon as it's made (or found up to date),
+      and replace the ones, which are the same as an earlier output byte
+      by byte, with a link to it. _reflink_ makes a copy sharing the data
+      with the original (FICLONE), and leaves the file as it is, if the
+      file system can't do it. _hardlink_ makes a hard link; an output
+      is removed before its backend is run, so that the backend doesn't
+      write through the link. Only works together with -b.
+
+  --preprocess-once
+      Run the preprocessor (-E) only once for every distinct preprocessor
+      configuration, before any combination is compiled, and give the
+      preprocessed source (.i or .ii, in a temporary directory) to the
+      backend instead of the only C or C++ source among the arguments.
+      Option values which don't change the preprocessed source, such as -g,
+      -W..., -c, and -O levels that define the same macros, are left out of
+      the configuration. Commands are reported with the original source
+      name. Can't be used together with --deps.
+
+  --pch header
+      Precompile _header_ once for every group of combinations, whose
+      option values the precompiled header depends on are the same (all of
+      them, but for warnings, -c and -S), before any combination is
+      compiled, and include it into every combination of the group
+      (-include, or -include-pch for clang). The header is compiled as
+      C++, if the backend name contains "++" or the header is named so.
+      The options among the arguments, along with their values (-I dir),
+      are passed when the header is precompiled, the sources aren't.
+      Commands are reported with "-include header". Can't be used together
+      with --deps or --preprocess-once.
+
+  --stream
+      Guarantee, that the memory _ccgen_ takes doesn't depend on the number
+      of combinations, which may be as large as the product of the number
+      of values of every option is (beyond 64 bits, too). The combinations
+      are formed, run (or printed) and forgotten one by one, in order, with
+      at most _jobs_ of them in flight. The features, which remember
+      something about every combination or need to count them
+      (--history, --shard, --dedup-commands, --dedup-outputs,
+      --preprocess-once and --pch) can't be used together with it.
+
+  --dry-run
+      Print the commands, one per line, instead of running them. With
+      --deps or --if-changed, only the commands of the outputs, which
+      aren't up to date, are printed. The cache isn't looked at.
+
+  --response-file mode
+      Write the arguments, which are the same in every command (the
+      args, and the options with a single value, which follow the last
+      option with many values), once into a response file (in a temporary
+      directory), and pass "@file" to the backend in their place, after the
+      options specific to the combination. Arguments are quoted the way
+      GCC and clang read them. _always_ does it for any backend, _never_
+      doesn't do it at all, and _auto_ (the default) does it for a compiler
+      backend (see --cache-dir), once the common arguments take 4 KiB or
+      more. Commands are reported with the arguments in place.
+
+  --emit-plan plan
+      Write all of the combinations into the binary file _plan_ and exit,
+      instead of running them. The plan keeps the backend, the output file
+      base name and extension, the arguments, every distinct string once,
+      the values of every option, and a row of value indices for every
+      combination, so that the plan of a matrix may be made on one host and
+      run on others.
+
+  --run-plan plan
+      Run the combinations of _plan_ (made by --emit-plan on a host of the
+      same byte order), instead of ones given by -o. The plan is mapped into
+      memory as it is; the backend, -b, -e and the arguments are taken from
+      it, so -x, -b, -e, -o and arguments can't be given. A combination is
+      found by its index directly, so --shard slices a plan the same way as
+      a matrix.
+
   -o option_spec
       Option specification. 
       _option_spec_ is a comma seperated list, which is logically divided in groups of two, each of which
@@ -37,6 +247,8 @@
       and it specifies meaning of an option for humans, which is used in output file name.
 
       If the second field of a group is missing, it is set to empty string.
+      Every fname is passed to a backend as a single argument, no shell is involved,
+      so it may contain spaces or quotes.
 
   -l log_file
       File, to which all of the logs will be sent.
@@ -70,24 +282,57 @@
   64 bit architecture without debug symbols, and so on.
 
   :::Return value:::
-  0 on success. Some negative value otherwise. */
+  0 on success. Some negative value otherwise, in particular
+  if any of the variants failed. */
   
 
+#define _GNU_SOURCE /* ppoll */
+
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <ctype.h>
 #include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <linux/fs.h> /* FICLONE */
 
 
 
 
-#define MAX_OPTIONS        (100)
-#define MAX_ARGS           (100)
-#define MAX_COMMAND_LEN    (1000)
-#define MAX_FILENAME_LEN   (50)
-#define MAX_OPTION_VALUES  (10)
+#define ADAPT_INTERVAL_MS  (1000)
+#define HISTORY_BUCKETS    (4096)
+#define DEDUP_BUCKETS      (4096)
+#define KILL_GRACE_MS      (5000) /* time between SIGTERM and SIGKILL of a timed out backend */
+#define SHA256_LEN         (32)
+#define CACHE_LOW_WATER    (90) /* percent of --cache-max-size the cache is evicted down to */
+#define CACHE_INDEX_SLACK  (4) /* times the live entries the index may grow to, before it's compacted */
+#define PP_DIGEST_SLOTS    (256) /* preprocessor configurations whose sources' hash is kept */
+#define DAEMON_SAVE_MS     (60000) /* how often the daemon saves the index */
+#define ARENA_BLOCK        (65536) /* smallest block an arena takes from malloc */
+#define RESPONSE_FILE_MIN  (4096) /* common arguments --response-file=auto moves into the file */
+#define PLAN_MAGIC         "ccgenpln"
+#define PLAN_VERSION       (1)
+#define PLAN_NONE          (UINT32_MAX) /* string offset of a missing string */
 
 /* helping functions */
 
@@ -110,6 +355,68 @@ void errno_exit(const char*,...);
    Otherwise, ccgen is exited with some negative return code. */
 void str_write(char *str, int *ind, size_t n, const char *fmt, ...);
 
+/* @function str_append
+
+   :::Summary:::
+   Append _len_ characters to string at index
+
+   :::Description:::
+   The same as _str_write_, but without formatting. */
+void str_append(char *str, int *ind, size_t n, const char *src, size_t len);
+
+/*
+  @struct arena
+  :::Summary:::
+  Bump allocator.
+
+  :::Description:::
+  Memory is taken from the chain of blocks in order, and is given
+  back only all at once, by _arena_reset_. The blocks themselves are
+  kept for reuse, so an arena, that is reset regularly, grows only up
+  to its largest use between the resets.
+
+  _first_ (struct arena_block*) is the first block of the chain,
+  _block_ is the one being allocated from, _used_ bytes of which are taken.
+
+  _arena_align_ is as aligned as any type, the way C99 lets it be said.
+*/
+union arena_align
+{
+  long double ld;
+  long long ll;
+  void *p;
+  void (*fn)(void);
+};
+
+struct arena_block
+{
+  struct arena_block *next;
+  size_t size;
+  union arena_align data[];
+};
+
+struct arena
+{
+  struct arena_block *first, *block;
+  size_t used;
+};
+
+/* @function arena_alloc
+
+   :::Summary:::
+   Allocate _size_ zeroed bytes from the arena
+
+   :::Description:::
+   The memory is aligned for any type. ccgen is exited,
+   if there is no memory. */
+void *arena_alloc(struct arena *, size_t size);
+
+/* @function arena_reset
+
+   :::Summary:::
+   Free everything allocated from the arena */
+void arena_reset(struct arena *);
+
 /*
   @struct option_value
   :::Summary:::
@@ -122,26 +429,41 @@ void str_write(char *str, int *ind, size_t n, const char *fmt, ...);
 
   _iname_ (char*) is the name of an option, which
   will be used to generate output file name. Optional.
+
+  _cmd_frag_ and _file_frag_ (char*) are the pieces the value
+  adds to a command and to an output file name (" fname" and "_iname"),
+  formed once at parse time; _cmd_len_ and _file_len_ are their lengths.
+
+  _group_ (int) tells apart values of the same option, which the
+  preprocessor (or a precompiled header) sees differently, with
+  --preprocess-once or --pch.
 */
 
 struct option_value
 {
   char *fname, *iname;
+  char *cmd_frag, *file_frag;
+  int cmd_len, file_len;
+  int group;
 };
 
 /*
-  @struct option
+  @struct option_spec
   :::Summary:::
   Option that has many values.
 
   :::Description:::
   One of the values of a concrete option
   is passed to a backend at any moment.
+
+  _opt_val_ (struct option_value*) are the _val_cnt_ values.
+
+  _group_cnt_ is the number of distinct _group_ of the values.
 */
-struct option
+struct option_spec
 {
-  struct option_value opt_val[MAX_OPTION_VALUES];
-  int val_cnt;
+  struct option_value *opt_val;
+  int val_cnt, group_cnt;
 };
 
 
@@ -152,247 +474,5148 @@ struct option
    Parses input.
 
   :::Notes:::
-  Note that the function is implemented through _getopt_ function,
-  instead of _argp_, because the latter is non-standard, despite being
-  more easy-to-use.
+  Note that the function is implemented through _getopt_long_ function,
+  instead of _argp_, because the latter is glibc-only, despite being
+  more easy-to-use. _getopt_long_ is available on BSDs as well.
 
 */
 void parse_input(int, char **);
 
 /*
-  @function call_backend
-
+  @struct job
   :::Summary:::
-  Calls backand passing it 
-  all needed options and arguments.
+  Backend process that is currently running.
+
+  :::Description:::
+  _pid_ (pid_t) is the process id of a backend,
+  or 0 if the slot is free.
+
+  _token_ (int) is the jobserver token the backend holds,
+  or -1 if it runs on the implicit token of _ccgen_ itself.
+
+  _rss_ (long) is the peak memory usage (KiB) the backend
+  was predicted to have, when admitted.
+
+  _start_ (struct timespec) is the time the backend was started at.
+
+  _deadline_ (long) is the time (ms since _start_) the next signal
+  is due at, -1 if there is no one.
+
+  _killed_ (int) is the last signal sent to the process group of
+  a timed out or cancelled backend, 0 if it's still within time.
+
+  _cancelled_ (int) is non-zero, if the backend was killed because of
+  a failure of another one.
+
+  _cached_ (int) is non-zero, if the output file _file_ is to
+  be stored in the cache under _key_, when the backend succeeds.
+
+  _stamped_ (int) is non-zero, if the command hash _hash_ is to
+  be written next to _file_, when the backend succeeds.
+
+  _dedup_ (struct dedup*) is the distinct command the backend runs,
+  whose duplicates wait for it, NULL without --dedup-commands.
 
+  _helper_ (int) is non-zero, if the backend preprocesses the source
+  or precompiles the header for the variants. It isn't a variant,
+  so it's kept out of the variant counts and the history file.
+
+  _cmd_ (char*) is the command the backend was started with.
+  It is kept to report the exit status of a variant. It and _file_
+  point into the buffers allocated by _buffers_init_.
+*/
+struct job
+{
+  pid_t pid;
+  int token;
+  long rss;
+  struct timespec start;
+  long deadline;
+  int killed, cancelled;
+  int cached, stamped;
+  unsigned char key[SHA256_LEN], hash[SHA256_LEN];
+  struct dedup *dedup;
+  int helper;
+  char *file, *cmd;
+};
+
+/*
+  @struct sha256
+  :::Summary:::
+  State of SHA-256 hash computation.
 */
-int call_backend(const char *);
+struct sha256
+{
+  uint32_t h[8];
+  uint64_t len;
+  unsigned char buf[64];
+};
 
+/*
+  @function sha256_init
 
+  :::Summary:::
+  Starts SHA-256 hash computation.
+*/
+void sha256_init(struct sha256 *);
 
 /*
-  @function doTheJob
+  @function sha256_update
 
   :::Summary:::
-  Iterates through all possible
-  combinations of options and their values.
+  Adds _len_ bytes to the hashed data.
 */
-void doTheJob(int);
+void sha256_update(struct sha256 *, const void *, size_t len);
+
+/*
+  @function sha256_final
 
+  :::Summary:::
+  Finishes hash computation, storing SHA256_LEN
+  bytes of the digest.
+*/
+void sha256_final(struct sha256 *, unsigned char *);
 
 /*
-  @function print_help
-  
+  @function sha256_file
+
   :::Summary:::
-  Prints help message.
+  Computes SHA-256 digest of contents of a regular file.
 
-  The argument should be the name
-  of the program, when it was invoked.
+  :::Description:::
+  Returns 0 on success, -1 if the file can't be read.
 */
-void print_help(const char*);
+int sha256_file(const char *, unsigned char *);
 
+/*
+  @function find_program
 
-/* global variables definitions */
-static struct option passed_options[MAX_OPTIONS]; /* array of options that eventually will be passed to a backend */
-static int cur_set[MAX_OPTIONS], option_count = 0, arg_count = 0;
-static char *backend = "cc";
-static char *outfile_base = NULL; /* if this field is NULL(not changed with command-line arguments,
-				     then we don't explicitly specify output file, 
-				     so we use backend's defaults */
+  :::Summary:::
+  Looks a program up in PATH, the way _posix_spawnp_ does,
+  and stores its path in the given PATH_MAX buffer.
 
-static char *arguments[MAX_ARGS], /* passed_arguments */
-  cmd_buf[MAX_COMMAND_LEN],       /* command formation buffer */
-  file_buf[MAX_FILENAME_LEN];     /* filename formation buffer */
-static char *logfile = NULL;      /* If it's non-NULL, redirect all output to that file */
-static char *extension = NULL;    /* If it's NULL, no extension is appended to output filename. */
-static const char * const ccgen_version = "1.0"; /* Current _ccgen_ version */
+  :::Description:::
+  Returns 0 on success, -1 if it's not found.
+*/
+int find_program(const char *, char *);
 
+/*
+  @function capture_output
 
+  :::Summary:::
+  Runs the given command and stores the first line of
+  its output in the buffer of the given size.
 
-/* -----------MAIN BEGIN--------- */
-int main(int argc, char *argv[])
-{
-  if (argc < 2)
-    {
-      print_help(argv[0]);
-      exit(EXIT_FAILURE);
-    }
-  parse_input(argc, argv);
+  :::Description:::
+  Errors of the command are thrown away. Returns 0 if the
+  command succeeds, -1 otherwise.
+*/
+int capture_output(char *const [], char *, size_t);
 
-  if (logfile)
-    {
-      freopen(logfile, "w", stdout);
-      freopen(logfile, "w", stderr);
-    }
- 
-  doTheJob(0);
+/*
+  @function hash_output
 
-  exit(EXIT_SUCCESS);
-}
-/* ----------MAIN END----------- */
+  :::Summary:::
+  Runs the given command and stores
+  the hash of its output in the buffer.
+
+  :::Description:::
+  Errors of the command are thrown away. Returns 0 if the
+  command succeeds, -1 otherwise.
+*/
+int hash_output(char *const [], unsigned char *);
 
+/*
+  @struct tool
+  :::Summary:::
+  Program of the toolchain, whose hash is known.
 
+  :::Description:::
+  _path_ (char*) is the program, _dev_, _ino_, _size_ and _mtime_
+  are what it was like when it was hashed, _digest_ is its hash.
 
-void parse_input(int argc, char *argv[])
+  Tools are kept in _cache_dir_/toolchain between runs,
+  and are chained through _next_.
+*/
+struct tool
 {
-  char *subopts, *value,  *just_null = NULL;
-  int c, i;
-  struct option tmp_option, *cur;
+  char *path;
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+  unsigned char digest[SHA256_LEN];
+  struct tool *next;
+};
 
-  opterr = 0;
-  while ((c = getopt(argc, argv, ":vhb:x:l:e:o:")) != -1)
-    {
-      switch(c)
-	{
-	case 'v': /* version information is needed */
-	  printf("ccgen %s\n", ccgen_version);
-	  exit(EXIT_SUCCESS);
-	  break;
-	case 'h': /* help information is needed */
-	  print_help(argv[0]);
-	  exit(EXIT_SUCCESS);
-	  break;
-	case 'b': /* base name of an output file */
-	  outfile_base = optarg;
-	  break;
-	case 'x': /* backend name */
-	  backend = optarg;
-	  break;
-	case 'l': /* logging to some file */
-	  logfile = optarg;
-	  break;
-	case 'e': /* output filename's extension */
-	  extension = optarg;
-	  break;
-	case 'o': /* some option which we ultimately
-		     pass to an underlying program */
-	  memset(&tmp_option, 0, sizeof(struct option));
+/*
+  @function tool_load
 
-	  subopts = optarg;
-	  cur = &passed_options[option_count++];
-	  for (i = 0; *subopts != '\0'; ++i)
-	    {
-	      getsubopt(&subopts, &just_null, &value);
+  :::Summary:::
+  Loads the hashes of the toolchain from _cache_dir_/toolchain,
+  if it exists.
+*/
+void tool_load(void);
 
-	      if (i % 2)
-		cur -> opt_val[cur -> val_cnt-1].iname = value;
-	      else
-		cur -> opt_val[cur -> val_cnt++].fname = value;
-	    }
-	  
-	  break;
-	case '?':
-	  error_exit("Unrecognized `-%c' option\n", optopt);
-	  break;
-	case ':':
-	  error_exit("Missing operand for `-%c' option\n", optopt);
-	  break;
-	default:
-	  abort();
-	}
-    }
-  
-  arg_count = argc - optind;
-  /* all of the remaining (if any) arguments
-     are copied without change */
-  memcpy(arguments, argv + optind, arg_count * sizeof(char*));
-}
+/*
+  @function tool_save
 
-int call_backend(const char *command)
-{
-  return system(command); /*currently we implement this
-			    through the abstraction, which
-			    was here before us in libc, but for 
-			    practice purposes it should
-			    be reimplemented in a harder
-			    way */
-}
+  :::Summary:::
+  Saves the hashes of the toolchain to _cache_dir_/toolchain,
+  if any of them has changed.
+*/
+void tool_save(void);
 
-void doTheJob(int opt)
-{
-  int i, j, cmd_ind = 0, file_ind = 0;
-  struct option_value *cur_val;
-  
-  if (opt == option_count)
-    {
-      str_write(cmd_buf,
-		&cmd_ind,
-		MAX_COMMAND_LEN - cmd_ind,
-		backend);
+/*
+  @function tool_digest
 
-      if (outfile_base)
-	str_write(file_buf,
-		  &file_ind,
-		  MAX_FILENAME_LEN - file_ind,
-		  outfile_base);
-      
-      for (i = 0; i < option_count; ++i)
-	{
-	  cur_val = &passed_options[i].opt_val[cur_set[i]];
-	  if (cur_val -> fname && strlen(cur_val -> fname))
-	    str_write(cmd_buf,
-		      &cmd_ind,
-		      MAX_COMMAND_LEN - cmd_ind,
-		      " %s", cur_val -> fname);
-	  if (outfile_base && cur_val -> iname && strlen(cur_val -> iname))
-	    str_write(file_buf,
-		      &file_ind,
-		      MAX_FILENAME_LEN - file_ind,
-		      "_%s", cur_val -> iname);
-	}
+  :::Summary:::
+  Stores the hash of the given program in the buffer.
 
-      if (outfile_base)
-	{
-	  if (extension)
-	    str_write(file_buf,
-		      &file_ind,
-		      MAX_FILENAME_LEN - file_ind,
-		      ".%s", extension);
-	  str_write(cmd_buf,
-		  &cmd_ind,
-		  MAX_COMMAND_LEN - cmd_ind,
-		  " -o %s", file_buf);
-	}
-      
-      for (i = 0; i < arg_count; ++i)
-	str_write(cmd_buf,
-		  &cmd_ind,
-		  MAX_COMMAND_LEN - cmd_ind,
-		  " %s", arguments[i]);
-      printf("Executing... %s\n", cmd_buf);
+  :::Description:::
+  The program is hashed only if it's unknown, or its inode, size or
+  modification time have changed. Returns 0 on success, -1 otherwise.
+*/
+int tool_digest(const char *, unsigned char *);
 
-      call_backend(cmd_buf);
-      return;
-    }
+/*
+  @function toolchain_hash
 
-  for (j = 0; j < passed_options[opt].val_cnt; ++j)
-    {
-      cur_set[opt] = j;
-      doTheJob(opt + 1);
-    }	
-}
+  :::Summary:::
+  Adds the hashes of the backend and of the programs
+  it runs to the context.
 
-void print_help(const char *prog)
-{
-  printf("Usage: %s [options]... file...\n", prog);
-  printf("Options:\n"
-	 "-l <log_file>\t\t\tSend all output to <log_file>.\n"
-	 "-x <backend>\t\t\tBackend name.\n"
-	 "-o <option_spec>\t\tOption specification.\n"
-	 "-b <base_file>\t\t\tOutput file base name.\n"
-	 "-h\t\t\t\tDisplay this help.\n"
-	 "-v\t\t\t\tDisplay version information\n");
-}
+  :::Description:::
+  The programs are found with -print-prog-name, only if
+  the backend looks like a compiler. ccgen is exited if the
+  backend can't be hashed.
+*/
+void toolchain_hash(struct sha256 *);
 
-void error_exit(const char *fmt, ...)
-{
-  va_list ap;
-  va_start(ap, fmt);
-  vfprintf(stderr, fmt, ap);
-  va_end(ap);
+/*
+  @function clone_file
 
-  exit(EXIT_FAILURE);
+  :::Summary:::
+  Copies the first file to the second one.
+
+  :::Description:::
+  The copy shares the data with the original (FICLONE), if the
+  file system can do it, and is written byte by byte otherwise. The
+  destination is replaced atomically, keeping the mode of the source.
+
+  Returns 0 on success, -1 otherwise.
+*/
+int clone_file(const char *, const char *);
+
+/*
+  @function cache_init
+
+  :::Summary:::
+  Hashes everything, which is the same for all of
+  the combinations: the backend executable and the arguments.
+*/
+void cache_init(void);
+
+/*
+  @function cache_key
+
+  :::Summary:::
+  Computes the cache key of the command in
+  _argv_buf_, leaving the output file name out.
+*/
+void cache_key(unsigned char *);
+
+/*
+  @function cache_sources
+
+  :::Summary:::
+  Adds the hash of the sources, as the compiler
+  sees them, to the given key.
+
+  :::Description:::
+  It's the hash of the sources preprocessed for the preprocessor
+  configuration of _cur_set_, so that the headers they include
+  count. The one made by --preprocess-once is taken, otherwise the
+  backend is run with -E; hashes of the last PP_DIGEST_SLOTS
+  configurations are kept. Does nothing unless the backend is a
+  compiler. Returns 0 on success, -1 if the sources can't be
+  preprocessed, then the combination isn't to be cached.
+*/
+int cache_sources(unsigned char *);
+
+/*
+  @struct pp_digest
+  :::Summary:::
+  Hash of the sources of a preprocessor configuration.
+
+  :::Description:::
+  _config_ is the hash of what the preprocessor sees of the option
+  values (see _pp_token_), _state_ is 1 if _digest_ is the hash of the
+  sources, -1 if they can't be preprocessed, 0 if the slot is empty.
+  Configurations aren't numbered like the groups of _group_init_,
+  since there may be more of them than 64 bits count with --stream.
+*/
+struct pp_digest
+{
+  unsigned char config[SHA256_LEN];
+  int state;
+  unsigned char digest[SHA256_LEN];
+};
+
+/*
+  @function cache_path
+
+  :::Summary:::
+  Stores the path of a cache entry in the given
+  PATH_MAX buffer.
+*/
+void cache_path(const unsigned char *, char *);
+
+/*
+  @function cache_fetch
+
+  :::Summary:::
+  Materializes the cache entry as the given file.
+
+  :::Description:::
+  Returns 1 on a hit, 0 on a miss.
+*/
+int cache_fetch(const unsigned char *, const char *);
+
+/*
+  @function cache_store
+
+  :::Summary:::
+  Stores the given file in the cache.
+*/
+void cache_store(const unsigned char *, const char *);
+
+/*
+  @function cache_restore
+
+  :::Summary:::
+  Copies the cache entry (the first argument) to the given file.
+
+  :::Description:::
+  With --deps, the depfile stored along with the entry is
+  restored too, see _depfile_restore_. Returns 0 on success,
+  -1 on failure, also when there is no depfile to restore.
+*/
+int cache_restore(const char *, const char *);
+
+/*
+  @function cache_unlink
+
+  :::Summary:::
+  Removes the cache entry of the given
+  key, along with its depfile.
+*/
+void cache_unlink(const unsigned char *);
+
+/*
+  @function depfile_restore
+
+  :::Summary:::
+  Copies the depfile _src_ to _dst_, naming _target_
+  as the target of its first rule.
+
+  :::Description:::
+  An entry is shared by the combinations, which differ only in the
+  output file name, so the stored depfile may name another one.
+  Returns 0 on success, -1 on failure.
+*/
+int depfile_restore(const char *src, const char *dst, const char *target);
+
+/*
+  @struct cache_record
+  :::Summary:::
+  Record of the cache index.
+
+  :::Description:::
+  The index (_cache_dir_/index) is a log of these, one is
+  appended whenever an entry is stored or hit. The latest
+  record of a key tells when the entry was used the last time
+  (_atime_) and its size (_size_).
+*/
+struct cache_record
+{
+  unsigned char key[SHA256_LEN];
+  int64_t atime, size;
+};
+
+/*
+  @function cache_lock
+
+  :::Summary:::
+  Locks the cache directory with _flock_, returns
+  the descriptor to unlock it with _close_.
+
+  :::Description:::
+  Appending to the index takes a shared lock,
+  rewriting it takes an exclusive one. Returns -1 if
+  the directory can't be locked.
+*/
+int cache_lock(int);
+
+/*
+  @function cache_touch
+
+  :::Summary:::
+  Appends a record of using an entry
+  of the given size now to the index.
+*/
+void cache_touch(const unsigned char *, int64_t);
+
+/*
+  @function cache_read_index
+
+  :::Summary:::
+  Reads the index, leaving only the latest record of every key.
+
+  :::Description:::
+  Returns the number of records, stored in a newly allocated array.
+  If the second argument isn't NULL, the number of records in the
+  index, repeated ones included, is stored there.
+*/
+size_t cache_read_index(struct cache_record **, size_t *);
+
+/*
+  @function cache_evict
+
+  :::Summary:::
+  Evicts least recently used entries, until the
+  cache fits into _cache_max_size_, and compacts the index.
+
+  :::Description:::
+  The index is rewritten also without --cache-max-size,
+  once it has grown past CACHE_INDEX_SLACK records
+  per entry, since every hit appends one.
+*/
+void cache_evict(void);
+
+/*
+  @function cache_write_index
+
+  :::Summary:::
+  Replaces the index with the given records.
+
+  :::Description:::
+  The caller holds the exclusive lock of the cache.
+*/
+void cache_write_index(const struct cache_record *, size_t);
+
+/*
+  @function cache_abort
+
+  :::Summary:::
+  Tells the daemon that the output of a missed
+  key won't be stored.
+*/
+void cache_abort(const unsigned char *);
+
+/*
+  @function key_hex
+
+  :::Summary:::
+  Stores a key in hex in the buffer
+  of 2 * SHA256_LEN + 1 characters.
+*/
+void key_hex(const unsigned char *, char *);
+
+/*
+  @function hex_key
+
+  :::Summary:::
+  Parses a key in hex. Returns 0 on
+  success, -1 if it's malformed.
+*/
+int hex_key(const char *, unsigned char *);
+
+/*
+  @struct daemon_entry
+  :::Summary:::
+  Entry of the cache, as the daemon sees it.
+
+  :::Description:::
+  _rec_ (struct cache_record) is the latest record of the entry,
+  _present_ (int) is non-zero, if the entry is in the cache.
+
+  _owner_ (int) is the connection of the run, which has missed
+  the entry and is making it, -1 if there is no one.
+
+  _waiters_ (int*) are the connections of the runs, which wait
+  for the owner, _nwaiters_ is their number.
+
+  Entries with the same hash are chained through _next_.
+*/
+struct daemon_entry
+{
+  struct cache_record rec;
+  int present, owner;
+  int *waiters, nwaiters;
+  struct daemon_entry *next;
+};
+
+/*
+  @function daemon_run
+
+  :::Summary:::
+  Serves the cache until SIGINT or SIGTERM.
+
+  :::Description:::
+  Requests are lines of text: "LOOKUP key" is answered with "HIT"
+  or "MISS" (and the one, who has missed, is to make the entry),
+  maybe after the owner of the entry is done with it; "STORE key size"
+  and "ABORT key" are sent by the owner, and aren't answered.
+  Connection is closed by a run, when it's over.
+*/
+void daemon_run(void);
+
+/*
+  @function daemon_find
+
+  :::Summary:::
+  Looks an entry with the given key up.
+
+  :::Description:::
+  A new one is created, if the second
+  argument is non-zero, otherwise NULL is returned.
+*/
+struct daemon_entry *daemon_find(const unsigned char *, int);
+
+/*
+  @function daemon_request
+
+  :::Summary:::
+  Handles a request (the second argument)
+  received on the given connection.
+*/
+void daemon_request(int, char *);
+
+/*
+  @function daemon_release
+
+  :::Summary:::
+  Gives the entry away to the first waiter,
+  when its owner won't store it.
+*/
+void daemon_release(struct daemon_entry *);
+
+/*
+  @function daemon_drop
+
+  :::Summary:::
+  Forgets a closed connection: the entries
+  it owns are released, it waits for nothing.
+*/
+void daemon_drop(int);
+
+/*
+  @function daemon_evict
+
+  :::Summary:::
+  Evicts least recently used entries, until the
+  cache fits into _cache_max_size_.
+*/
+void daemon_evict(void);
+
+/*
+  @function daemon_save
+
+  :::Summary:::
+  Writes the index and adds the statistics
+  gathered since the last save.
+
+  :::Description:::
+  Runs, which don't use the daemon, may have appended records to
+  the index meanwhile. They are merged in first: the later access
+  time counts, and an entry unknown to the daemon is taken, if its
+  file is there (it isn't, if the daemon has evicted it since).
+*/
+void daemon_save(void);
+
+/*
+  @function daemon_connect
+
+  :::Summary:::
+  Connects to the daemon of _cache_dir_,
+  if there is one.
+*/
+void daemon_connect(void);
+
+/*
+  @function daemon_send
+
+  :::Summary:::
+  Sends a formatted request to the daemon.
+
+  :::Description:::
+  It's sent with MSG_NOSIGNAL, so that a daemon gone away doesn't
+  kill us with SIGPIPE; ignoring the signal instead would be inherited
+  by the backends. Returns 0 on success, -1 on failure.
+*/
+int daemon_send(const char *fmt, ...);
+
+/*
+  @function daemon_lookup
+
+  :::Summary:::
+  Asks the daemon for the entry with the given key.
+
+  :::Description:::
+  Running backends are reaped, while the answer is awaited. If one
+  of them is making the entry, it's waited for before asking.
+  Returns 1 on a hit, 0 on a miss, -1 if the daemon is gone.
+*/
+int daemon_lookup(const unsigned char *);
+
+/*
+  @function daemon_stop_handler
+
+  :::Summary:::
+  Makes the daemon save everything and exit.
+*/
+void daemon_stop_handler(int);
+
+/*
+  @function cache_add_stats
+
+  :::Summary:::
+  Adds the given numbers of hits, misses and evictions
+  to the counters in _cache_dir_/stats.
+*/
+void cache_add_stats(long, long, long);
+
+/*
+  @function cache_print_stats
+
+  :::Summary:::
+  Prints the counters and the size of the cache.
+*/
+void cache_print_stats(void);
+
+/*
+  @struct history
+  :::Summary:::
+  Measurements of a backend command, kept
+  between runs in the history file.
+
+  :::Description:::
+  _cmd_ (char*) is the command, as it's printed.
+
+  _rss_ (long) is the peak memory usage (KiB) of the command.
+
+  _msec_ (long) is the time the command took to run.
+
+  Entries with the same hash are chained through _next_.
+*/
+struct history
+{
+  char *cmd;
+  long rss, msec;
+  struct history *next;
+};
+
+/*
+  @function history_find
+
+  :::Summary:::
+  Looks up history of a command.
+
+  :::Description:::
+  If there is no entry for the command and the second
+  argument is non-zero, a new zeroed entry is created, otherwise
+  NULL is returned.
+*/
+struct history *history_find(const char *, int);
+
+/*
+  @function history_load
+
+  :::Summary:::
+  Loads history file, if it exists.
+*/
+void history_load(const char *);
+
+/*
+  @function history_save
+
+  :::Summary:::
+  Saves all of the history to a file.
+*/
+void history_save(const char *);
+
+/*
+  @struct duplicate
+  :::Summary:::
+  Combination, whose command is the same as the one
+  of an earlier combination, but for the output file name.
+
+  :::Description:::
+  _file_ (char*) is the output file, _cmd_ (char*) is the command,
+  as it's printed. _stamped_ and _hash_ are as in struct job.
+
+  Duplicates of the same command are chained through _next_.
+*/
+struct duplicate
+{
+  char *file, *cmd;
+  int stamped;
+  unsigned char hash[SHA256_LEN];
+  struct duplicate *next;
+};
+
+/*
+  @struct dedup
+  :::Summary:::
+  Distinct command of a run, with --dedup-commands.
+
+  :::Description:::
+  _key_ (unsigned char[]) is the hash of the command, computed
+  the same way as the cache key.
+
+  _file_ (char*) is the output file of the combination the
+  backend is run for.
+
+  _state_ is DEDUP_RUNNING until the backend finishes, then
+  the outcome of it, which the duplicates share.
+
+  _pending_ (struct duplicate*) are the duplicates, which have
+  come while the backend was running.
+
+  Entries with the same hash are chained through _next_.
+*/
+struct dedup
+{
+  unsigned char key[SHA256_LEN];
+  char *file;
+  enum {DEDUP_RUNNING, DEDUP_DONE, DEDUP_FAILED, DEDUP_CANCELLED} state;
+  struct duplicate *pending;
+  struct dedup *next;
+};
+
+/*
+  @function dedup_find
+
+  :::Summary:::
+  Looks the command with the given key up, and
+  returns its entry.
+
+  :::Description:::
+  A new entry (with NULL _file_) is created, if
+  the command hasn't been seen yet.
+*/
+struct dedup *dedup_find(const unsigned char *);
+
+/*
+  @function dedup_copy
+
+  :::Summary:::
+  Copies the output of a distinct command to
+  the output file of a duplicate, and reports it.
+
+  :::Description:::
+  The depfile and the command stamp are made for the duplicate
+  as well, if they are used; the depfile names the duplicate's
+  output file as its target, see _depfile_restore_.
+*/
+void dedup_copy(const struct dedup *, const struct duplicate *);
+
+/*
+  @struct output
+  :::Summary:::
+  Output file made in this run, with --dedup-outputs.
+
+  :::Description:::
+  _digest_ (unsigned char[]) is the hash of its contents,
+  _file_ (char*) is its name.
+
+  Entries with the same hash are chained through _next_.
+*/
+struct output
+{
+  unsigned char digest[SHA256_LEN];
+  char *file;
+  struct output *next;
+};
+
+/*
+  @function dedup_output
+
+  :::Summary:::
+  Replaces the given output file with a link to an earlier
+  output having the same contents, or remembers it, if there is none.
+*/
+void dedup_output(const char *);
+
+/*
+  @function link_file
+
+  :::Summary:::
+  Replaces the second file with a link to the first one.
+
+  :::Description:::
+  If the third argument is non-zero, it's a hard link, otherwise
+  a copy sharing the data with the original (FICLONE). The destination
+  is replaced atomically. Returns 0 on success, -1 otherwise.
+*/
+int link_file(const char *, const char *, int);
+
+/*
+  @function dedup_done
+
+  :::Summary:::
+  Records the outcome (the second argument) of a distinct
+  command, and passes it on to the pending duplicates.
+*/
+void dedup_done(struct dedup *, int);
+
+/*
+  @struct plan_header
+  :::Summary:::
+  Beginning of a plan file (--emit-plan).
+
+  :::Description:::
+  _magic_ is PLAN_MAGIC, _version_ is PLAN_VERSION, _byte_order_ is
+  0x01020304 as the host which made the plan writes it.
+
+  _strings_, _options_, _values_, _args_ and _jobs_ are the offsets of
+  the tables in the file, each of them aligned to 8 bytes:
+  - string table (_strings_size_ bytes), every distinct string
+    once, null-terminated; strings are referred to by offsets in it,
+    PLAN_NONE means there is no string;
+  - _option_count_ of struct plan_option;
+  - _value_count_ of struct plan_value;
+  - _arg_count_ string offsets (uint32_t) of the arguments;
+  - _job_count_ rows of _option_count_ value indices (of the option's
+    own values), _index_size_ (1, 2 or 4) bytes each.
+
+  _backend_, _outfile_base_ and _extension_ are string offsets.
+*/
+struct plan_header
+{
+  char magic[8];
+  uint32_t version, byte_order;
+  uint32_t option_count, value_count, arg_count, index_size;
+  uint32_t backend, outfile_base, extension, reserved;
+  uint64_t job_count;
+  uint64_t strings, strings_size, options, values, args, jobs;
+};
+
+/* values _first_.._first_ + _count_ - 1 of the value table belong to the option */
+struct plan_option
+{
+  uint32_t first, count;
+};
+
+/* string offsets of an option value */
+struct plan_value
+{
+  uint32_t fname, iname;
+};
+
+/*
+  @function plan_emit
+
+  :::Summary:::
+  Writes the plan of all of the combinations into the given file.
+
+  :::Description:::
+  Rows are written one by one as the combinations are
+  enumerated, so the plan isn't kept in memory.
+*/
+void plan_emit(const char *);
+
+/*
+  @function plan_string
+
+  :::Summary:::
+  Returns the offset of the string in the string table
+  of the plan being made, adding it, if it isn't there yet.
+
+  :::Description:::
+  _table_ has room for _size_ offsets (a power of two), _strings_
+  for every string there is to add. Returns PLAN_NONE for NULL.
+*/
+uint32_t plan_string(const char *, char *strings, uint64_t *len,
+		     uint32_t *table, size_t size);
+
+/*
+  @function plan_load
+
+  :::Summary:::
+  Maps the given plan file into memory, and sets up
+  the options, the arguments, the backend, -b and -e from it.
+
+  :::Description:::
+  The strings are used right in the mapping. ccgen
+  is exited, if the file isn't a valid plan.
+*/
+void plan_load(const char *);
+
+/*
+  @function plan_row
+
+  :::Summary:::
+  Sets _cur_set_ to the row of the plan with the given index.
+
+  :::Description:::
+  Returns the first option whose value has changed,
+  _option_count_ if none has.
+*/
+int plan_row(uint64_t);
+
+/*
+  @function predict_rss
+
+  :::Summary:::
+  Predicts peak memory usage (KiB) of a command.
+
+  :::Description:::
+  Until the first backend finishes, a command without
+  history is predicted to take the whole _mem_limit_.
+*/
+long predict_rss(const char *);
+
+/*
+  @function parse_size
+
+  :::Summary:::
+  Parses size with optional K, M, G or T suffix.
+
+  :::Description:::
+  The result is in bytes, ccgen is exited if the
+  size is malformed.
+*/
+long long parse_size(const char *);
+
+/*
+  @function job_limit
+
+  :::Summary:::
+  Number of backends allowed to run right now.
+
+  :::Description:::
+  Without --max-load and --max-pressure it's just _max_jobs_.
+
+  Otherwise the system is sampled at most once in
+  ADAPT_INTERVAL_MS. The limit is increased by one while load and
+  pressure are below their targets and the limit is used up, and halved
+  above them. The load lags behind the backends started, so growing it
+  only additively, and only when it binds, keeps it from overshooting.
+  It never drops below 1.
+*/
+int job_limit(void);
+
+/*
+  @function read_pressure
+
+  :::Summary:::
+  Returns avg10 of the "some" line of the
+  given /proc/pressure file, 0 if it's unavailable.
+*/
+double read_pressure(const char *);
+
+/*
+  @function jobserver_init
+
+  :::Summary:::
+  Joins the jobserver of GNU make, or starts
+  our own one.
+
+  :::Description:::
+  An inherited jobserver is looked for in MAKEFLAGS, both the
+  "fifo:PATH" and the "R,W" forms of --jobserver-auth= (and the older
+  --jobserver-fds=) are understood.
+
+  If there is none and more than one job may run at once,
+  a pipe holding _max_jobs_ - 1 tokens is created and
+  advertised to the backends through MAKEFLAGS.
+*/
+void jobserver_init(void);
+
+/*
+  @function jobserver_reopen
+
+  :::Summary:::
+  Opens the read end of the jobserver pipe
+  once more, into _js_poll_.
+
+  :::Description:::
+  The new open file description is made non-blocking, so that
+  a token taken by another client between ppoll and read doesn't
+  leave us blocked in read with backends unreaped. If /proc is not
+  mounted, _js_read_ itself is used.
+*/
+void jobserver_reopen(void);
+
+/*
+  @function jobserver_take
+
+  :::Summary:::
+  Takes a token for a backend which is about to start.
+
+  :::Description:::
+  Returns -1 if the implicit token is free, otherwise waits
+  for a token in the jobserver and returns it. Running backends
+  are reaped meanwhile, so their tokens are not lost.
+*/
+int jobserver_take(void);
+
+/*
+  @function jobserver_give
+
+  :::Summary:::
+  Returns a token, previously taken with _jobserver_take_.
+*/
+void jobserver_give(int);
+
+/*
+  @function call_backend
+
+  :::Summary:::
+  Calls backand passing it 
+  all needed options and arguments.
+
+  :::Description:::
+  Backend is started asynchronously with _posix_spawnp_,
+  so that no shell is involved: every element of the NULL-terminated
+  argument vector reaches the backend as it is.
+
+  The pid of a started process is returned, or -1 if
+  the backend couldn't be started.
+
+  SIGCHLD is blocked in _ccgen_ all the time but while
+  it sleeps for a jobserver token, backends get the original mask.
+*/
+pid_t call_backend(char *const []);
+
+/*
+  @function run_job
+
+  :::Summary:::
+  Starts backend in a free job slot.
+
+  :::Description:::
+  If all of the _max_jobs_ slots are busy, waits
+  for one of the running backends to finish first.
+
+  The first argument is the argument vector of a backend,
+  the second one is its printable form used for reporting.
+  The third one, if non-NULL, is the cache key to store the
+  output file under. The fourth one, if non-NULL, is the command
+  hash to write next to the output file. The fifth one, if non-NULL,
+  gets the outcome of the backend.
+*/
+void run_job(char *const [], const char *, const unsigned char *, const unsigned char *,
+	     struct dedup *);
+
+/*
+  @function reap_job
+
+  :::Summary:::
+  Waits for any running backend to finish
+  and reports its exit status.
+
+  :::Description:::
+  If the argument is zero, only a backend which has
+  already finished is reaped. Returns 1 if a backend
+  was reaped, 0 otherwise (also when there is
+  no child left to wait for).
+*/
+int reap_job(int);
+
+/*
+  @function kill_job
+
+  :::Summary:::
+  Sends a signal to the process group of a backend
+  in the given slot.
+
+  :::Description:::
+  After SIGTERM, SIGKILL is due in KILL_GRACE_MS.
+*/
+void kill_job(int, int);
+
+/*
+  @function check_timeouts
+
+  :::Summary:::
+  Signals the process groups of backends, which are out of time.
+
+  :::Description:::
+  Returns the number of milliseconds till the next
+  signal is due, or -1 if there is no one.
+*/
+long check_timeouts(void);
+
+/*
+  @function sleep_event
+
+  :::Summary:::
+  Sleeps for the given number of milliseconds (-1 means forever),
+  or until a backend finishes or a timeout is due, whatever is first.
+
+  :::Description:::
+  Optional file descriptor (-1 if none) wakes
+  the sleep up as well, when it becomes readable. Returns
+  1 if it's readable, 0 otherwise.
+*/
+int sleep_event(long, int);
+
+/*
+  @function elapsed_ms
+
+  :::Summary:::
+  Returns the number of milliseconds
+  passed since the given time.
+*/
+long elapsed_ms(const struct timespec *);
+
+
+
+/*
+  @function doTheJob
+
+  :::Summary:::
+  Iterates through all possible
+  combinations of options and their values.
+
+  :::Description:::
+  A combination is a value index for every option, kept in _cur_set_.
+  Combinations are enumerated as a mixed-radix number, the last option
+  being the least significant digit, so no recursion is involved.
+*/
+void doTheJob(void);
+
+/*
+  @function combo_init
+
+  :::Summary:::
+  Computes _combo_stride_, which _combo_at_ and _combo_index_
+  rely on, and the number of combinations.
+
+  :::Description:::
+  Called once by _buffers_init_. The number may not fit 64 bits
+  (that's fine with --stream), then only _combo_count_ fails.
+*/
+void combo_init(void);
+
+/*
+  @function combo_count
+
+  :::Summary:::
+  Returns the number of combinations.
+
+  :::Description:::
+  ccgen is exited if the number doesn't fit 64 bits. With
+  --run-plan, it's the number of rows of the plan.
+*/
+uint64_t combo_count(void);
+
+/*
+  @function combo_at
+
+  :::Summary:::
+  Sets _cur_set_ to the combination with the given index
+  (the row of the plan with --run-plan).
+
+  :::Description:::
+  Returns the first option whose value has changed,
+  _option_count_ if none has.
+*/
+int combo_at(uint64_t);
+
+/*
+  @function combo_index
+
+  :::Summary:::
+  Returns the index of the combination in _cur_set_,
+  the inverse of _combo_at_.
+*/
+uint64_t combo_index(void);
+
+/*
+  @function combo_next
+
+  :::Summary:::
+  Advances _cur_set_ to the next combination.
+
+  :::Description:::
+  Returns the first option whose value has changed, or -1
+  if _cur_set_ has wrapped around to the first combination.
+*/
+int combo_next(void);
+
+/*
+  @function shard_range
+
+  :::Summary:::
+  Finds the slice of combinations the
+  shard is to run.
+
+  :::Description:::
+  The slice is [*begin, *end) with *step
+  between the combinations.
+*/
+void shard_range(uint64_t *, uint64_t *, uint64_t *);
+
+/*
+  @function form_command
+
+  :::Summary:::
+  Forms _argv_buf_, _cmd_buf_ and _file_buf_ for
+  the combination in _cur_set_.
+
+  :::Description:::
+  Only the options starting from the given one are formed anew,
+  the part before it is reused from the previous call. So the argument
+  should be 0 for the first call, and the return value of _combo_next_
+  (or _combo_at_) after that.
+*/
+void form_command(int);
+
+/*
+  @function buffers_init
+
+  :::Summary:::
+  Allocates the formation buffers, the per-option arrays
+  and the buffers of the job slots from _spec_arena_.
+
+  :::Description:::
+  The buffers are sized to fit the longest command and output file
+  name of all of the combinations, so that nothing is allocated, while
+  the combinations are run. _max_jobs_ slots should be allocated already.
+*/
+void buffers_init(void);
+
+/*
+  @function stream_init
+
+  :::Summary:::
+  Checks, that the features requested can be used with --stream.
+
+  :::Description:::
+  The combinations are enumerated by _combo_next_ anyway, which
+  neither counts them, nor remembers them, so all there is left to do is
+  to reject the features which do.
+*/
+void stream_init(void);
+
+/*
+  @function make_fragment
+
+  :::Summary:::
+  Returns _prefix_ concatenated with _str_ in
+  a newly allocated string, and stores its length in *len.
+
+  :::Description:::
+  If _str_ is NULL or empty, an empty
+  fragment is returned.
+*/
+char *make_fragment(const char *prefix, const char *str, int *len);
+
+/*
+  @function deps_fresh
+
+  :::Summary:::
+  Checks whether the output file in _file_buf_ is newer
+  than everything it depends on.
+
+  :::Description:::
+  The dependencies are taken from the depfile _dep_buf_, written
+  by the backend on the previous run. Returns 0 if there is no
+  output or no depfile, or if any dependency is newer or missing.
+*/
+int deps_fresh(void);
+
+/*
+  @function stamp_fresh
+
+  :::Summary:::
+  Checks whether the output file in _file_buf_ is newer
+  than the arguments and was made by the same command.
+
+  :::Description:::
+  The argument is the hash of the command, as computed by
+  _command_hash_; it is compared to the one in the stamp file
+  _stamp_buf_. Arguments, which aren't files, are not checked.
+*/
+int stamp_fresh(const unsigned char *);
+
+/*
+  @function stamp_write
+
+  :::Summary:::
+  Writes command hash (the second argument) in hex
+  into the stamp file of the output file _file_.
+*/
+void stamp_write(const char *file, const unsigned char *);
+
+/*
+  @function command_hash
+
+  :::Summary:::
+  Computes the hash of the whole command in _argv_buf_.
+*/
+void command_hash(unsigned char *);
+
+/*
+  @function is_newer
+
+  :::Summary:::
+  Returns non-zero, if the first file was modified
+  later than the second one.
+*/
+int is_newer(const struct stat *, const struct stat *);
+
+/*
+  @function run_combination
+
+  :::Summary:::
+  Forms a command for the combination
+  in _cur_set_ and runs it.
+
+  :::Description:::
+  The argument is the same as of _form_command_.
+*/
+void run_combination(int);
+
+/*
+  @function pp_token
+
+  :::Summary:::
+  Returns what the preprocessor makes of
+  an option value (the argument).
+
+  :::Description:::
+  It's "" for values, which don't change the preprocessed
+  source, a normalized -O level for the ones that only change
+  predefined macros, and the value itself otherwise.
+*/
+const char *pp_token(const char *);
+
+/*
+  @function pch_token
+
+  :::Summary:::
+  Returns what a precompiled header
+  depends on of an option value (the argument).
+
+  :::Description:::
+  It's "" for values, which only change warnings or
+  the kind of output, and the value itself otherwise.
+*/
+const char *pch_token(const char *);
+
+/*
+  @function option_value
+
+  :::Summary:::
+  Tells whether the given argument is an option of the
+  compiler, whose value is the next argument (-I dir...).
+*/
+int option_value(const char *);
+
+/*
+  @function group_init
+
+  :::Summary:::
+  Groups the values of every option by the token, which the
+  given function (_pp_token_ or _pch_token_) returns for them.
+
+  :::Description:::
+  Values with equal tokens get the same _group_. Groups of
+  combinations are numbered the same way as combinations, the last
+  option being the least significant digit; _group_count_ is their number.
+*/
+void group_init(const char *(*)(const char *));
+
+/*
+  @function group_index
+
+  :::Summary:::
+  Returns the group of the combination in _cur_set_.
+*/
+uint64_t group_index(void);
+
+/*
+  @function group_command
+
+  :::Summary:::
+  Appends the option values of the given group to the argument vector
+  _args_ (at index *argc), and to the command _cmd_ (at index *ind)
+  of _size_ characters.
+
+  :::Description:::
+  Any value of a group will do, the ones, for
+  which the function gives empty token, are left out.
+*/
+void group_command(uint64_t, const char *(*)(const char *),
+		   char **args, int *argc, char *cmd, int *ind, size_t size);
+
+/*
+  @function tmp_init
+
+  :::Summary:::
+  Creates the temporary directory _tmp_dir_.
+
+  :::Description:::
+  It's removed on exit, see _tmp_cleanup_.
+*/
+void tmp_init(void);
+
+/*
+  @function tmp_cleanup
+
+  :::Summary:::
+  Removes the temporary directory with everything in it.
+
+  :::Description:::
+  Registered with _atexit_, so that error_exit and errno_exit don't
+  leave it behind; _sigterm_check_ calls it before ccgen is killed.
+  Does nothing, once the directory is removed.
+*/
+void tmp_cleanup(void);
+
+/*
+  @function response_init
+
+  :::Summary:::
+  Writes the arguments common to all of the
+  combinations into the response file, if it's needed.
+
+  :::Description:::
+  Sets _rsp_arg_, _rsp_text_ and _rsp_from_, which _form_command_
+  uses then. Should be called after _preprocess_init_, if at all, since
+  the preprocessed source takes the place of the original one.
+*/
+void response_init(void);
+
+/*
+  @function response_quote
+
+  :::Summary:::
+  Appends _arg_ to _text_ at index *ind, quoted
+  for a response file of GCC, and a newline.
+
+  :::Description:::
+  Blanks, quotes and backslashes are escaped with backslash,
+  an empty argument is written as ''. _text_ should have room
+  for 2 * strlen(arg) + 3 more characters.
+*/
+void response_quote(char *text, size_t *ind, const char *arg);
+
+/*
+  @function preprocess_init
+
+  :::Summary:::
+  Finds the source to preprocess and the
+  distinct preprocessor configurations.
+*/
+void preprocess_init(void);
+
+/*
+  @function preprocess_all
+
+  :::Summary:::
+  Preprocesses the source once for every configuration,
+  and waits for all of them.
+*/
+void preprocess_all(void);
+
+/*
+  @function preprocess_path
+
+  :::Summary:::
+  Stores the name of the preprocessed source of
+  the given configuration in the PATH_MAX buffer.
+*/
+void preprocess_path(uint64_t, char *);
+
+/*
+  @function pch_init
+
+  :::Summary:::
+  Finds the groups of combinations, which may
+  share a precompiled header.
+*/
+void pch_init(void);
+
+/*
+  @function pch_all
+
+  :::Summary:::
+  Precompiles the header once for every group,
+  and waits for all of them.
+*/
+void pch_all(void);
+
+/*
+  @function pch_path
+
+  :::Summary:::
+  Stores the name the precompiled header of the given group
+  is included by in the PATH_MAX buffer.
+
+  :::Description:::
+  For GCC it's a link to the header, with the precompiled
+  header next to it (".gch" appended), for clang it's the
+  precompiled header itself.
+*/
+void pch_path(uint64_t, char *);
+
+/*
+  @function stable_arg
+
+  :::Summary:::
+  Returns the element of _argv_buf_ with the given index,
+  as it's to be hashed.
+
+  :::Description:::
+  Names in _tmp_dir_ differ from run to run, so the
+  preprocessed source is hashed as the original one, the
+  precompiled header as the header, and the response file
+  as its contents.
+*/
+const char *stable_arg(int);
+
+/*
+  @function print_help
+  
+  :::Summary:::
+  Prints help message.
+
+  The argument should be the name
+  of the program, when it was invoked.
+*/
+void print_help(const char*);
+
+/*
+  @function sigchld_handler
+
+  :::Summary:::
+  Does nothing, the signal only
+  interrupts waiting for a backend or a jobserver token.
+*/
+void sigchld_handler(int);
+
+/*
+  @function sigterm_handler
+
+  :::Summary:::
+  Stores SIGINT, SIGTERM or SIGHUP in _term_signal_,
+  see _sigterm_check_.
+*/
+void sigterm_handler(int);
+
+/*
+  @function sigterm_check
+
+  :::Summary:::
+  If _term_signal_ is set, passes the signal on to the process
+  groups of running backends, waits for them, removes the temporary
+  directory and dies of the signal. Does nothing otherwise.
+
+  :::Description:::
+  Backends don't belong to our process group, so they won't get a
+  signal from the terminal unless we pass it on. The ones, which
+  ignore it, are killed after KILL_GRACE_MS; a second signal kills
+  _ccgen_ at once. Called whenever _ccgen_ sleeps (see _sleep_event_)
+  and before a backend is started, since the handler itself may
+  do nothing more than setting the flag.
+*/
+void sigterm_check(void);
+
+
+/* global variables definitions */
+static struct option_spec *passed_options = NULL; /* array of options that eventually will be passed to a backend */
+static int *cur_set, option_count = 0, option_cap = 0, arg_count = 0;
+static uint64_t *combo_stride,    /* number of combinations an option's value stays the same for */
+  combo_total = 0;                /* number of combinations, see _combo_overflow_ */
+static int combo_overflow = 0;    /* whether the number doesn't fit 64 bits */
+static struct arena spec_arena,   /* options, their values and everything sized after them */
+  scratch_arena;                  /* memory of a single combination, reset before the next one */
+static struct job *jobs = NULL;   /* job slots, _max_jobs_ of them */
+static int max_jobs = 0,          /* if it's 0, number of online processors is used */
+  running_jobs = 0;
+static int js_read = -1,          /* jobserver pipe (or fifo) ends, -1 if there is no jobserver */
+  js_write = -1,
+  js_poll = -1,                   /* non-blocking read end of our own, _js_read_ if it can't be had */
+  implicit_token = 1;             /* whether the token _ccgen_ itself runs on is free */
+static sigset_t orig_mask,        /* signal mask _ccgen_ was started with */
+  term_mask;                      /* SIGINT, SIGTERM and SIGHUP */
+static volatile sig_atomic_t term_signal = 0; /* the one of them received, 0 if none */
+static double max_load = 0,       /* targets of adaptive scheduling, 0 if not used */
+  max_pressure = 0;
+static int adapt_limit = 1;       /* current limit of adaptive scheduling */
+static long job_timeout = 0;      /* time (ms) a backend is given to finish, 0 if unlimited */
+static int shard = 0,             /* shard of combinations to run, 1.._shard_count_ */
+  shard_count = 0;                /* 0 if all of the combinations are run */
+static enum {SHARD_CONTIGUOUS, SHARD_STRIDED, SHARD_BALANCED} shard_mode = SHARD_CONTIGUOUS;
+static int keep_going = 0,        /* run everything, regardless of failures (the default) */
+  fail_fast = 0;                  /* start no more and cancel running backends after a failure */
+static uint64_t failed_jobs = 0,  /* number of failed variants */
+  total_jobs = 0;                 /* number of variants tried */
+static int helper_jobs = 0,       /* the backends started are helpers (-E, PCH), see _struct job_ */
+  failed_helpers = 0;             /* number of failed helpers */
+static long mem_limit = 0,        /* memory budget (KiB) of running backends, 0 if unlimited */
+  mem_running = 0,                /* predicted memory usage of running backends */
+  max_rss_seen = 0;               /* the largest peak memory usage seen in this run */
+static char *history_file = NULL; /* If it's non-NULL, measurements are loaded from and saved to that file */
+static struct history *history_tab[HISTORY_BUCKETS];
+static int dedup_commands = 0;    /* run the same commands only once */
+static struct dedup *dedup_tab[DEDUP_BUCKETS];
+static enum {LINK_NONE, LINK_REFLINK, LINK_HARDLINK} dedup_outputs = LINK_NONE;
+static int stream = 0,            /* keep no state of the combinations */
+  dry_run = 0;                    /* print the commands instead of running them */
+static enum {RESPONSE_AUTO, RESPONSE_ALWAYS, RESPONSE_NEVER} response_file = RESPONSE_AUTO;
+static char *rsp_arg = NULL,      /* "@file" argument, NULL if there is no response file */
+  *rsp_text = NULL;               /* contents of the response file */
+static int rsp_from = 0;          /* options from this one on are in the response file */
+static char *plan_out = NULL,     /* if it's non-NULL, the plan is written there instead of running it */
+  *plan_in = NULL;                /* if it's non-NULL, combinations are taken from that plan */
+static const unsigned char *plan_rows = NULL; /* value indices of the plan's combinations */
+static uint64_t plan_jobs = 0;    /* number of them */
+static int plan_index_size = 0;   /* size of an index */
+static struct output *output_tab[DEDUP_BUCKETS];
+static long outputs_linked = 0;   /* number of outputs replaced with links */
+static long long bytes_saved = 0; /* their total size */
+static int preprocess_once = 0,   /* preprocess every configuration only once */
+  pp_source = -1;                 /* index of the source in _arguments_ */
+static char *pp_ext = "i";
+static char *pch_header = NULL;   /* If it's non-NULL, it's precompiled once for every group */
+static int pch_clang = 0;         /* whether the backend is clang */
+static char *tmp_dir = NULL;      /* directory of preprocessed sources or precompiled headers */
+static uint64_t group_count = 0,  /* number of groups of combinations */
+  *group_stride;
+static char *cache_dir = NULL;    /* If it's non-NULL, outputs are cached there */
+static unsigned char cache_base[SHA256_LEN]; /* hash of backend and arguments */
+static int cache_pp = 0;          /* whether keys include the hash of the preprocessed sources */
+static struct pp_digest pp_digests[PP_DIGEST_SLOTS];
+static char **pp_args;            /* argument vector of preprocessing for a key */
+static struct tool *tools = NULL; /* hashes of the toolchain */
+static int tools_changed = 0;     /* whether they are to be saved */
+static long long cache_max_size = 0; /* if it's non-zero, cache is evicted down to it */
+static long cache_hits = 0, cache_misses = 0, cache_stores = 0;
+static int cache_stats = 0;       /* only print cache statistics */
+static int daemon_mode = 0,       /* serve the cache to other runs */
+  daemon_fd = -1;                 /* connection to the daemon, -1 if there is no one */
+static volatile sig_atomic_t daemon_stop = 0;
+static struct daemon_entry *daemon_tab[DEDUP_BUCKETS];
+static long long daemon_total = 0; /* size of the entries in the cache */
+static long daemon_evictions = 0;
+static int deps = 0;              /* let backend write depfiles, skip outputs newer than their dependencies */
+static int if_changed = 0;        /* skip outputs newer than the arguments, made by the same command */
+static posix_spawnattr_t spawn_attr;
+static char *backend = "cc";
+static char *outfile_base = NULL; /* if this field is NULL(not changed with command-line arguments,
+				     then we don't explicitly specify output file, 
+				     so we use backend's defaults */
+
+static char **arguments,          /* passed_arguments */
+  **argv_buf,                     /* argument vector formation buffer */
+  *cmd_buf,                       /* command formation buffer */
+  *file_buf,                      /* filename formation buffer */
+  *dep_buf,                       /* depfile name formation buffer */
+  *stamp_buf,                     /* command stamp file name formation buffer */
+  pp_buf[PATH_MAX],               /* preprocessed source name formation buffer */
+  pch_buf[PATH_MAX],              /* precompiled header name formation buffer */
+  *args_frag = "";                /* " arg1 arg2...", the tail of every command */
+static int args_len = 0,
+  *cmd_mark,                      /* lengths of the buffers before an option was formed */
+  *file_mark,
+  *argv_mark;
+static size_t cmd_size = 0,       /* sizes of the formation buffers, which fit any combination */
+  file_size = 0,
+  argv_size = 0;
+static char *logfile = NULL;      /* If it's non-NULL, redirect all output to that file */
+static char *extension = NULL;    /* If it's NULL, no extension is appended to output filename. */
+static const char * const ccgen_version = "1.0"; /* Current _ccgen_ version */
+
+
+
+/* -----------MAIN BEGIN--------- */
+int main(int argc, char *argv[])
+{
+  sigset_t mask;
+
+  if (argc < 2)
+    {
+      print_help(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  parse_input(argc, argv);
+
+  if (logfile)
+    {
+      freopen(logfile, "w", stdout);
+      freopen(logfile, "w", stderr);
+    }
+
+  if (cache_stats)
+    {
+      if (!cache_dir || !*cache_dir)
+	error_exit("No cache directory, use --cache-dir or CCGEN_CACHE_DIR\n");
+      cache_print_stats();
+      exit(EXIT_SUCCESS);
+    }
+  if (daemon_mode)
+    {
+      if (!cache_dir || !*cache_dir)
+	error_exit("No cache directory, use --cache-dir or CCGEN_CACHE_DIR\n");
+      daemon_run();
+      exit(EXIT_SUCCESS);
+    }
+ 
+  if (stream)
+    stream_init();
+  if (max_jobs <= 0 && (max_jobs = sysconf(_SC_NPROCESSORS_ONLN)) <= 0)
+    max_jobs = 1;
+  if (!(jobs = calloc(max_jobs, sizeof(struct job))))
+    errno_exit("Can't allocate %d job slots\n", max_jobs);
+  buffers_init();
+  if (plan_out)
+    {
+      plan_emit(plan_out);
+      exit(EXIT_SUCCESS);
+    }
+
+  signal(SIGCHLD, sigchld_handler);
+  signal(SIGINT, sigterm_handler);
+  signal(SIGTERM, sigterm_handler);
+  signal(SIGHUP, sigterm_handler);
+  sigemptyset(&term_mask);
+  sigaddset(&term_mask, SIGINT);
+  sigaddset(&term_mask, SIGTERM);
+  sigaddset(&term_mask, SIGHUP);
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask, &orig_mask);
+  posix_spawnattr_init(&spawn_attr);
+  posix_spawnattr_setsigmask(&spawn_attr, &orig_mask);
+  posix_spawnattr_setpgroup(&spawn_attr, 0);
+  posix_spawnattr_setflags(&spawn_attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETPGROUP);
+  jobserver_init();
+  if (history_file)
+    history_load(history_file);
+  if (cache_dir && *cache_dir && outfile_base && !dry_run)
+    {
+      cache_init();
+      daemon_connect();
+    }
+  else
+    cache_dir = NULL;
+  if (!outfile_base) /* there is nothing to copy */
+    dedup_commands = dedup_outputs = 0;
+  if (preprocess_once)
+    {
+      preprocess_init();
+      if (!dry_run)
+	preprocess_all();
+    }
+  else if (pch_header)
+    {
+      pch_init();
+      if (!dry_run)
+	pch_all();
+    }
+  if (!dry_run)
+    response_init();
+
+  if (!fail_fast || !failed_helpers)
+    doTheJob();
+
+  while (running_jobs)
+    reap_job(1);
+  tmp_cleanup();
+  if (history_file)
+    history_save(history_file);
+  if (daemon_fd != -1) /* the daemon keeps the statistics and evicts */
+    close(daemon_fd);
+  else if (cache_dir)
+    {
+      cache_add_stats(cache_hits, cache_misses, 0);
+      if (cache_stores || cache_hits)
+	{
+	  fflush(stdout);
+	  if (fork() == 0) /* it's nothing to wait for */
+	    {
+	      cache_evict();
+	      _exit(EXIT_SUCCESS);
+	    }
+	}
+    }
+
+  if (outputs_linked)
+    printf("%ld identical outputs linked, %lld bytes saved\n", outputs_linked, bytes_saved);
+  if (failed_helpers)
+    printf("%d helper jobs (preprocessing, PCH) failed\n", failed_helpers);
+  if (failed_jobs)
+    printf("%llu of %llu variants failed\n",
+	   (unsigned long long) failed_jobs, (unsigned long long) total_jobs);
+  if (failed_jobs || failed_helpers)
+    exit(EXIT_FAILURE);
+  exit(EXIT_SUCCESS);
+}
+/* ----------MAIN END----------- */
+
+
+
+void parse_input(int argc, char *argv[])
+{
+  char *subopts, *value,  *just_null = NULL, *end, tail;
+  int c, i, planned = 0;          /* number of -x, -b and -e, which a plan gives */
+  struct option_spec *cur;
+  struct option_value *cur_val;
+
+  static const struct option long_options[] =
+    {
+      {"max-load", required_argument, NULL, 'L'},
+      {"max-pressure", required_argument, NULL, 'P'},
+      {"mem-limit", required_argument, NULL, 'M'},
+      {"history", required_argument, NULL, 'H'},
+      {"timeout", required_argument, NULL, 'T'},
+      {"fail-fast", no_argument, &fail_fast, 1},
+      {"keep-going", no_argument, &keep_going, 1},
+      {"shard", required_argument, NULL, 'S'},
+      {"shard-mode", required_argument, NULL, 'm'},
+      {"cache-dir", required_argument, NULL, 'C'},
+      {"cache-max-size", required_argument, NULL, 'Z'},
+      {"cache-stats", no_argument, &cache_stats, 1},
+      {"daemon", no_argument, &daemon_mode, 1},
+      {"deps", no_argument, &deps, 1},
+      {"if-changed", no_argument, &if_changed, 1},
+      {"dedup-commands", no_argument, &dedup_commands, 1},
+      {"dedup-outputs", required_argument, NULL, 'D'},
+      {"preprocess-once", no_argument, &preprocess_once, 1},
+      {"pch", required_argument, NULL, 'p'},
+      {"stream", no_argument, &stream, 1},
+      {"dry-run", no_argument, &dry_run, 1},
+      {"response-file", required_argument, NULL, 'R'},
+      {"emit-plan", required_argument, NULL, 'E'},
+      {"run-plan", required_argument, NULL, 'r'},
+      {NULL, 0, NULL, 0}
+    };
+
+  cache_dir = getenv("CCGEN_CACHE_DIR");
+  opterr = 0;
+  while ((c = getopt_long(argc, argv, ":vhb:x:l:e:o:j:", long_options, NULL)) != -1)
+    {
+      switch(c)
+	{
+	case 'v': /* version information is needed */
+	  printf("ccgen %s\n", ccgen_version);
+	  exit(EXIT_SUCCESS);
+	  break;
+	case 'h': /* help information is needed */
+	  print_help(argv[0]);
+	  exit(EXIT_SUCCESS);
+	  break;
+	case 'b': /* base name of an output file */
+	  outfile_base = optarg;
+	  ++planned;
+	  break;
+	case 'x': /* backend name */
+	  backend = optarg;
+	  ++planned;
+	  break;
+	case 'l': /* logging to some file */
+	  logfile = optarg;
+	  break;
+	case 'e': /* output filename's extension */
+	  extension = optarg;
+	  ++planned;
+	  break;
+	case 'j': /* number of simultaneously running backends */
+	  errno = 0;
+	  max_jobs = strtol(optarg, &end, 10);
+	  if (errno || *end != '\0' || max_jobs <= 0)
+	    error_exit("Invalid job count `%s'\n", optarg);
+	  break;
+	case 'L': /* target load average */
+	case 'P': /* target pressure */
+	  errno = 0;
+	  *(c == 'L' ? &max_load : &max_pressure) = strtod(optarg, &end);
+	  if (errno || *end != '\0' || (c == 'L' ? max_load : max_pressure) <= 0)
+	    error_exit("Invalid target `%s'\n", optarg);
+	  break;
+	case 'M': /* memory budget of running backends */
+	  if ((mem_limit = parse_size(optarg) / 1024) <= 0)
+	    error_exit("Invalid memory limit `%s'\n", optarg);
+	  break;
+	case 'H': /* file with measurements of previous runs */
+	  history_file = optarg;
+	  break;
+	case 'T': /* time limit of a backend */
+	  errno = 0;
+	  job_timeout = strtod(optarg, &end) * 1000;
+	  if (errno || *end != '\0' || job_timeout <= 0)
+	    error_exit("Invalid timeout `%s'\n", optarg);
+	  break;
+	case 'S': /* slice of combinations to run */
+	  if (sscanf(optarg, "%d/%d%c", &shard, &shard_count, &tail) != 2
+	      || shard < 1 || shard > shard_count)
+	    error_exit("Invalid shard `%s'\n", optarg);
+	  break;
+	case 'm': /* how the combinations are sliced */
+	  if (!strcmp(optarg, "contiguous"))
+	    shard_mode = SHARD_CONTIGUOUS;
+	  else if (!strcmp(optarg, "strided"))
+	    shard_mode = SHARD_STRIDED;
+	  else if (!strcmp(optarg, "balanced"))
+	    shard_mode = SHARD_BALANCED;
+	  else
+	    error_exit("Invalid shard mode `%s'\n", optarg);
+	  break;
+	case 'p': /* header to precompile */
+	  pch_header = optarg;
+	  break;
+	case 'D': /* how identical outputs are linked */
+	  if (!strcmp(optarg, "reflink"))
+	    dedup_outputs = LINK_REFLINK;
+	  else if (!strcmp(optarg, "hardlink"))
+	    dedup_outputs = LINK_HARDLINK;
+	  else
+	    error_exit("Invalid dedup mode `%s'\n", optarg);
+	  break;
+	case 'R': /* when common arguments go to a response file */
+	  if (!strcmp(optarg, "auto"))
+	    response_file = RESPONSE_AUTO;
+	  else if (!strcmp(optarg, "always"))
+	    response_file = RESPONSE_ALWAYS;
+	  else if (!strcmp(optarg, "never"))
+	    response_file = RESPONSE_NEVER;
+	  else
+	    error_exit("Invalid response file mode `%s'\n", optarg);
+	  break;
+	case 'E': /* file to write the plan to */
+	  plan_out = optarg;
+	  break;
+	case 'r': /* plan to run */
+	  plan_in = optarg;
+	  break;
+	case 'C': /* directory of cached outputs */
+	  cache_dir = optarg;
+	  break;
+	case 'Z': /* size the cache is evicted down to */
+	  if ((cache_max_size = parse_size(optarg)) <= 0)
+	    error_exit("Invalid cache size `%s'\n", optarg);
+	  break;
+	case 0: /* flag is set by getopt_long */
+	  break;
+	case 'o': /* some option which we ultimately
+		     pass to an underlying program */
+	  if (option_count == option_cap)
+	    {
+	      option_cap = option_cap ? option_cap * 2 : 16;
+	      if (!(passed_options = realloc(passed_options, option_cap * sizeof(struct option_spec))))
+		errno_exit("Can't allocate options\n");
+	    }
+	  cur = &passed_options[option_count++];
+	  memset(cur, 0, sizeof(struct option_spec));
+
+	  /* every pair of fields is a value */
+	  for (i = 1, subopts = optarg; *subopts; ++subopts)
+	    i += *subopts == ',';
+	  cur -> opt_val = arena_alloc(&spec_arena, (i + 1) / 2 * sizeof(struct option_value));
+
+	  subopts = optarg;
+	  for (i = 0; *subopts != '\0'; ++i)
+	    {
+	      getsubopt(&subopts, &just_null, &value);
+
+	      if (i % 2)
+		cur -> opt_val[cur -> val_cnt-1].iname = value;
+	      else
+		cur -> opt_val[cur -> val_cnt++].fname = value;
+	    }
+	  
+	  break;
+	case '?':
+	  if (optopt)
+	    error_exit("Unrecognized `-%c' option\n", optopt);
+	  error_exit("Unrecognized `%s' option\n", argv[optind - 1]);
+	  break;
+	case ':':
+	  error_exit("Missing operand for `%s' option\n", argv[optind - 1]);
+	  break;
+	default:
+	  abort();
+	}
+    }
+  
+  if (fail_fast && keep_going)
+    error_exit("--fail-fast can't be used together with --keep-going\n");
+
+  arg_count = argc - optind;
+  /* all of the remaining (if any) arguments
+     are passed without change */
+  arguments = argv + optind;
+  if (plan_in)
+    {
+      if (option_count || arg_count)
+	error_exit("--run-plan takes the options and the arguments from the plan\n");
+      if (planned)
+	error_exit("--run-plan takes the backend, -b and -e from the plan\n");
+      if (plan_out)
+	error_exit("--run-plan can't be used together with --emit-plan\n");
+      plan_load(plan_in);
+    }
+
+  /* pieces of commands are formed once, combinations only glue them */
+  for (c = 0; c < option_count; ++c)
+    for (i = 0; i < passed_options[c].val_cnt; ++i)
+      {
+	cur_val = &passed_options[c].opt_val[i];
+	cur_val -> cmd_frag = make_fragment(" ", cur_val -> fname, &cur_val -> cmd_len);
+	cur_val -> file_frag = make_fragment("_", cur_val -> iname, &cur_val -> file_len);
+      }
+  for (i = 0; i < arg_count; ++i)
+    args_len += 1 + strlen(arguments[i]);
+  args_frag = arena_alloc(&spec_arena, args_len + 1);
+  for (*args_frag = '\0', i = 0; i < arg_count; ++i)
+    strcat(strcat(args_frag, " "), arguments[i]);
+}
+
+pid_t call_backend(char *const args[])
+{
+  extern char **environ;
+  pid_t pid;
+  int err;
+
+  fflush(stdout); /* don't let backend's output overtake ours */
+  if ((err = posix_spawnp(&pid, args[0], NULL, &spawn_attr, args, environ)))
+    {
+      fprintf(stderr, "Can't start `%s': %s\n", args[0], strerror(err));
+      return -1;
+    }
+  return pid;
+}
+
+void run_job(char *const args[], const char *command,
+	     const unsigned char *key, const unsigned char *hash,
+	     struct dedup *dedup)
+{
+  int i, token;
+  long rss = mem_limit ? predict_rss(command) : 0;
+  pid_t pid;
+
+  sigterm_check();
+  while (running_jobs >= job_limit()
+	 || (running_jobs && mem_running + rss > mem_limit && mem_limit))
+    if (max_load || max_pressure)
+      {
+	/* woken up by a finished backend, or to look at the load again */
+	sleep_event(ADAPT_INTERVAL_MS, -1);
+	while (running_jobs && reap_job(0))
+	  ;
+      }
+    else
+      reap_job(1);
+  if ((failed_jobs || failed_helpers) && fail_fast) /* it failed while we were waiting */
+    {
+      if (dedup)
+	dedup_done(dedup, DEDUP_CANCELLED);
+      if (key)
+	cache_abort(key);
+      return;
+    }
+  token = jobserver_take();
+
+  printf("Executing... %s\n", command);
+  if (!helper_jobs)
+    ++total_jobs;
+  if ((pid = call_backend(args)) == -1)
+    {
+      if (helper_jobs)
+	++failed_helpers;
+      else
+	++failed_jobs;
+      jobserver_give(token);
+      if (dedup)
+	dedup_done(dedup, DEDUP_FAILED);
+      if (key)
+	cache_abort(key);
+      return;
+    }
+
+  for (i = 0; jobs[i].pid; ++i)
+    ;
+  strcpy(jobs[i].cmd, command);
+  jobs[i].pid = pid;
+  jobs[i].token = token;
+  jobs[i].rss = rss;
+  jobs[i].deadline = job_timeout ? job_timeout : -1;
+  jobs[i].killed = jobs[i].cancelled = 0;
+  if ((jobs[i].cached = key != NULL))
+    memcpy(jobs[i].key, key, SHA256_LEN);
+  if ((jobs[i].stamped = hash != NULL))
+    memcpy(jobs[i].hash, hash, SHA256_LEN);
+  jobs[i].dedup = dedup;
+  jobs[i].helper = helper_jobs;
+  strcpy(jobs[i].file, file_buf);
+  clock_gettime(CLOCK_MONOTONIC, &jobs[i].start);
+  ++running_jobs;
+  mem_running += rss;
+}
+
+int reap_job(int block)
+{
+  int i, j, status;
+  pid_t pid;
+  struct rusage usage;
+  struct history *h;
+
+  for (;;)
+    {
+      if ((pid = wait4(-1, &status, WNOHANG, &usage)) == -1 && errno == ECHILD)
+	return 0; /* all of them are reaped already */
+      if (pid == -1 && errno != EINTR)
+	errno_exit("Can't wait for a backend\n");
+      if (pid > 0 || !block)
+	break;
+      sleep_event(-1, -1);
+    }
+  if (pid <= 0)
+    return 0;
+
+  for (i = 0; i < max_jobs && jobs[i].pid != pid; ++i)
+    ;
+  if (i == max_jobs) /* not a backend of ours */
+    return 0;
+
+  if (jobs[i].cancelled)
+    printf("Cancelled... %s\n", jobs[i].cmd);
+  else if (jobs[i].killed)
+    printf("Timed out... %s\n", jobs[i].cmd);
+  else if (WIFEXITED(status) && !WEXITSTATUS(status))
+    printf("Done... %s\n", jobs[i].cmd);
+  else if (WIFEXITED(status))
+    printf("Failed with status %d... %s\n", WEXITSTATUS(status), jobs[i].cmd);
+  else if (WIFSIGNALED(status))
+    printf("Killed by signal %d... %s\n", WTERMSIG(status), jobs[i].cmd);
+
+  if (!jobs[i].cancelled
+      && (jobs[i].killed || !WIFEXITED(status) || WEXITSTATUS(status)))
+    {
+      if (jobs[i].helper)
+	++failed_helpers;
+      else
+	++failed_jobs;
+      if (jobs[i].cached) /* the waiters are to make it themselves */
+	cache_abort(jobs[i].key);
+      jobs[i].pid = 0; /* not to cancel it below */
+      if (fail_fast)
+	for (j = 0; j < max_jobs; ++j)
+	  if (jobs[j].pid && !jobs[j].killed)
+	    {
+	      jobs[j].cancelled = 1;
+	      kill_job(j, SIGTERM);
+	    }
+    }
+
+  else if (!jobs[i].cancelled)
+    {
+      if (jobs[i].cached)
+	cache_store(jobs[i].key, jobs[i].file);
+      if (jobs[i].stamped)
+	stamp_write(jobs[i].file, jobs[i].hash);
+      if (dedup_outputs)
+	dedup_output(jobs[i].file);
+    }
+  else if (jobs[i].cached)
+    cache_abort(jobs[i].key);
+
+  if (jobs[i].dedup) /* the slot of a failed backend is already freed */
+    dedup_done(jobs[i].dedup, jobs[i].cancelled ? DEDUP_CANCELLED
+	       : jobs[i].pid ? DEDUP_DONE : DEDUP_FAILED);
+
+  if (usage.ru_maxrss > max_rss_seen)
+    max_rss_seen = usage.ru_maxrss;
+  if (history_file && !jobs[i].helper) /* its command names a temporary file */
+    {
+      h = history_find(jobs[i].cmd, 1);
+      h -> rss = usage.ru_maxrss;
+      if (!jobs[i].cancelled)
+	h -> msec = elapsed_ms(&jobs[i].start);
+    }
+
+  jobs[i].pid = 0;
+  --running_jobs;
+  mem_running -= jobs[i].rss;
+  jobserver_give(jobs[i].token);
+  return 1;
+}
+
+struct history *history_find(const char *cmd, int create)
+{
+  unsigned long hash = 5381;
+  const char *p;
+  struct history **h;
+
+  for (p = cmd; *p; ++p)
+    hash = hash * 33 + (unsigned char) *p;
+  for (h = &history_tab[hash % HISTORY_BUCKETS]; *h; h = &(*h) -> next)
+    if (!strcmp((*h) -> cmd, cmd))
+      return *h;
+
+  if (!create)
+    return NULL;
+  if (!(*h = calloc(1, sizeof(struct history))) || !((*h) -> cmd = strdup(cmd)))
+    errno_exit("Can't allocate history entry\n");
+  return *h;
+}
+
+void history_load(const char *path)
+{
+  FILE *f;
+  char *line = NULL, *cmd;
+  size_t size = 0;
+  ssize_t len;
+  long rss, msec;
+  struct history *h;
+
+  if (!(f = fopen(path, "r")))
+    return;
+  while ((len = getline(&line, &size, f)) != -1)
+    {
+      if (len && line[len - 1] == '\n')
+	line[len - 1] = '\0';
+      rss = strtol(line, &cmd, 10);
+      if (*cmd++ != '\t')
+	continue;
+      msec = strtol(cmd, &cmd, 10);
+      if (*cmd++ != '\t')
+	continue;
+      h = history_find(cmd, 1);
+      h -> rss = rss;
+      h -> msec = msec;
+    }
+  free(line);
+  fclose(f);
+}
+
+void history_save(const char *path)
+{
+  FILE *f;
+  struct history *h;
+  int i;
+
+  if (!(f = fopen(path, "w")))
+    errno_exit("Can't save history to `%s'\n", path);
+  for (i = 0; i < HISTORY_BUCKETS; ++i)
+    for (h = history_tab[i]; h; h = h -> next)
+      fprintf(f, "%ld\t%ld\t%s\n", h -> rss, h -> msec, h -> cmd);
+  if (fclose(f))
+    errno_exit("Can't save history to `%s'\n", path);
+}
+
+long predict_rss(const char *cmd)
+{
+  struct history *h = history_find(cmd, 0);
+
+  if (h && h -> rss)
+    return h -> rss;
+  /* with nothing measured yet, a backend may take all the budget */
+  return max_rss_seen ? max_rss_seen : mem_limit;
+}
+
+long long parse_size(const char *str)
+{
+  long long size;
+  char *end;
+
+  errno = 0;
+  size = strtoll(str, &end, 10);
+  if (errno || end == str || size < 0)
+    error_exit("Invalid size `%s'\n", str);
+  switch (*end)
+    {
+    case 'T': case 't':
+      size *= 1024;
+      /* fall through */
+    case 'G': case 'g':
+      size *= 1024;
+      /* fall through */
+    case 'M': case 'm':
+      size *= 1024;
+      /* fall through */
+    case 'K': case 'k':
+      size *= 1024;
+      ++end;
+    }
+  if (*end != '\0')
+    error_exit("Invalid size `%s'\n", str);
+  return size;
+}
+
+int job_limit(void)
+{
+  static struct timespec last;
+  double load = 0, pressure = 0, p;
+  int below = 1;
+  FILE *f;
+
+  if (!max_load && !max_pressure)
+    return max_jobs;
+
+  if (elapsed_ms(&last) < ADAPT_INTERVAL_MS)
+    return adapt_limit;
+  clock_gettime(CLOCK_MONOTONIC, &last);
+
+  if (max_load && (f = fopen("/proc/loadavg", "r")))
+    {
+      if (fscanf(f, "%lf", &load) != 1)
+	load = 0;
+      fclose(f);
+      below = load < max_load;
+    }
+  if (max_pressure)
+    {
+      pressure = read_pressure("/proc/pressure/cpu");
+      if ((p = read_pressure("/proc/pressure/memory")) > pressure)
+	pressure = p;
+      if ((p = read_pressure("/proc/pressure/io")) > pressure)
+	pressure = p;
+      below = below && pressure < max_pressure;
+    }
+
+  if (!below)
+    adapt_limit /= 2;
+  else if (running_jobs >= adapt_limit)
+    ++adapt_limit;
+
+  if (adapt_limit > max_jobs)
+    adapt_limit = max_jobs;
+  if (adapt_limit < 1)
+    adapt_limit = 1;
+  return adapt_limit;
+}
+
+double read_pressure(const char *path)
+{
+  double avg10;
+  FILE *f;
+
+  if (!(f = fopen(path, "r")))
+    return 0;
+  if (fscanf(f, "some avg10=%lf", &avg10) != 1)
+    avg10 = 0;
+  fclose(f);
+  return avg10;
+}
+
+void kill_job(int i, int sig)
+{
+  kill(-jobs[i].pid, sig);
+  jobs[i].killed = sig;
+  jobs[i].deadline = sig == SIGKILL ? -1
+    : elapsed_ms(&jobs[i].start) + KILL_GRACE_MS;
+}
+
+long check_timeouts(void)
+{
+  long next = -1, left;
+  int i;
+
+  for (i = 0; i < max_jobs; ++i)
+    {
+      if (!jobs[i].pid || jobs[i].deadline == -1)
+	continue;
+      left = jobs[i].deadline - elapsed_ms(&jobs[i].start);
+      if (left <= 0)
+	{
+	  kill_job(i, jobs[i].killed ? SIGKILL : SIGTERM);
+	  if (jobs[i].deadline == -1)
+	    continue;
+	  left = KILL_GRACE_MS;
+	}
+      if (next == -1 || left < next)
+	next = left;
+    }
+  return next;
+}
+
+int sleep_event(long timeout_ms, int fd)
+{
+  struct timespec timeout;
+  struct pollfd pfd;
+  long next = check_timeouts();
+  int ready;
+
+  if (next != -1 && (timeout_ms == -1 || next < timeout_ms))
+    timeout_ms = next;
+  timeout.tv_sec = timeout_ms / 1000;
+  timeout.tv_nsec = timeout_ms % 1000 * 1000000;
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+
+  /* SIGCHLD is let in only while we sleep, so that a finished backend
+     wakes us up; a terminating signal is held back from the check
+     till then, not to be slept through */
+  sigprocmask(SIG_BLOCK, &term_mask, NULL);
+  sigterm_check();
+  ready = ppoll(&pfd, fd != -1, timeout_ms == -1 ? NULL : &timeout, &orig_mask);
+  sigprocmask(SIG_UNBLOCK, &term_mask, NULL);
+  sigterm_check();
+  return ready == 1;
+}
+
+long elapsed_ms(const struct timespec *since)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - since -> tv_sec) * 1000
+    + (now.tv_nsec - since -> tv_nsec) / 1000000;
+}
+
+void jobserver_init(void)
+{
+  char *flags, *auth, *p, path[PATH_MAX];
+  int i, fds[2];
+
+  if ((flags = getenv("MAKEFLAGS")))
+    {
+      /* the last one wins, as in make itself */
+      for (auth = NULL, p = flags; (p = strstr(p, "--jobserver-")); ++p)
+	if (!strncmp(p, "--jobserver-auth=", 17))
+	  auth = p + 17;
+	else if (!strncmp(p, "--jobserver-fds=", 16))
+	  auth = p + 16;
+
+      if (auth && !strncmp(auth, "fifo:", 5))
+	{
+	  for (i = 0; auth[5 + i] && auth[5 + i] != ' ' && i < PATH_MAX - 1; ++i)
+	    path[i] = auth[5 + i];
+	  path[i] = '\0';
+	  /* the fifo is opened by us alone, so it's safe to make it non-blocking */
+	  if ((js_read = js_write = js_poll = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC)) != -1)
+	    return;
+	}
+      else if (auth && sscanf(auth, "%d,%d", &js_read, &js_write) == 2
+	       && fcntl(js_read, F_GETFD) != -1 && fcntl(js_write, F_GETFD) != -1)
+	{
+	  jobserver_reopen();
+	  return;
+	}
+      /* make didn't consider us a recursive make, so we're on our own */
+      js_read = js_write = -1;
+    }
+
+  if (max_jobs == 1)
+    return;
+
+  if (pipe(fds) == -1)
+    errno_exit("Can't create jobserver\n");
+  js_read = fds[0];
+  js_write = fds[1];
+  for (i = 0; i < max_jobs - 1; ++i)
+    if (write(js_write, "+", 1) != 1)
+      errno_exit("Can't fill jobserver\n");
+
+  p = malloc((flags ? strlen(flags) : 0) + 64);
+  if (!p)
+    errno_exit("Can't allocate MAKEFLAGS\n");
+  sprintf(p, "%s -j%d --jobserver-auth=%d,%d",
+	  flags ? flags : "", max_jobs, js_read, js_write);
+  setenv("MAKEFLAGS", p, 1);
+  free(p);
+  jobserver_reopen();
+}
+
+void jobserver_reopen(void)
+{
+  char path[64];
+
+  /* the pipe is shared with make and the backends, which expect it to
+     block, so a description of our own is opened to be made non-blocking */
+  sprintf(path, "/proc/self/fd/%d", js_read);
+  if ((js_poll = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC)) == -1)
+    js_poll = js_read;
+}
+
+int jobserver_take(void)
+{
+  unsigned char token;
+
+  for (;;)
+    {
+      if (implicit_token)
+	{
+	  implicit_token = 0;
+	  return -1;
+	}
+      if (js_read == -1) /* -j 1 without make, nothing to wait for but our backend */
+	{
+	  reap_job(1);
+	  continue;
+	}
+
+      /* a finished backend wakes us up and gives its token back; another
+	 client may take the token first, then read fails with EAGAIN */
+      if (sleep_event(-1, js_poll) && read(js_poll, &token, 1) == 1)
+	return token;
+
+      while (reap_job(0))
+	;
+    }
+}
+
+void jobserver_give(int token)
+{
+  unsigned char c = token;
+
+  if (token == -1)
+    implicit_token = 1;
+  else
+    while (write(js_write, &c, 1) == -1 && errno == EINTR)
+      ;
+}
+
+void sigchld_handler(int sig)
+{
+  (void) sig; /* only makes ppoll return */
+}
+
+void sigterm_handler(int sig)
+{
+  term_signal = sig;
+}
+
+void sigterm_check(void)
+{
+  int i, sig = term_signal;
+
+  if (!sig)
+    return;
+  term_signal = 0;
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+  signal(SIGHUP, SIG_DFL);
+  sigprocmask(SIG_UNBLOCK, &term_mask, NULL);
+
+  for (i = 0; i < max_jobs; ++i)
+    if (jobs[i].pid && !jobs[i].killed)
+      {
+	jobs[i].cancelled = 1;
+	kill_job(i, sig);
+      }
+  /* the backends may still write into the temporary directory */
+  while (running_jobs)
+    reap_job(1);
+  tmp_cleanup();
+  fflush(stdout);
+  raise(sig);
+}
+
+void doTheJob(void)
+{
+  uint64_t index, end, step;
+  int i, from = 0;
+
+  for (i = 0; i < option_count; ++i)
+    if (!passed_options[i].val_cnt) /* no combinations at all */
+      return;
+
+  if (!shard_count && !plan_rows)
+    {
+      memset(cur_set, 0, option_count * sizeof(int));
+      do
+	run_combination(from);
+      while ((from = combo_next()) != -1 && (!fail_fast || !failed_jobs));
+      return;
+    }
+
+  if (shard_count)
+    shard_range(&index, &end, &step);
+  else /* the whole plan */
+    {
+      index = 0;
+      end = plan_jobs;
+      step = 1;
+    }
+  for (combo_at(index); index < end && (!fail_fast || !failed_jobs); index += step)
+    {
+      run_combination(from);
+      if (step == 1 && !plan_rows)
+	from = combo_next();
+      else if (end - index > step)
+	from = combo_at(index + step);
+    }
+}
+
+void shard_range(uint64_t *begin, uint64_t *end, uint64_t *step)
+{
+  uint64_t count = combo_count(), known = 0, index;
+  double total = 0, mean, cost, sum;
+  struct history *h;
+  int pass, from;
+
+  *step = 1;
+  switch (shard_mode)
+    {
+    case SHARD_STRIDED:
+      *begin = shard - 1;
+      *end = count;
+      *step = shard_count;
+      return;
+    case SHARD_CONTIGUOUS:
+      /* count * (shard - 1) / shard_count, without overflow */
+      *begin = count / shard_count * (shard - 1)
+	+ count % shard_count * (shard - 1) / shard_count;
+      *end = count / shard_count * shard
+	+ count % shard_count * shard / shard_count;
+      return;
+    case SHARD_BALANCED:
+      break;
+    }
+
+  /* the first pass finds the average runtime, the second one
+     finds where the cumulative runtime crosses shard borders */
+  *begin = *end = count;
+  mean = 1;
+  for (pass = 0; pass < 2; ++pass)
+    {
+      memset(cur_set, 0, option_count * sizeof(int));
+      for (index = 0, sum = 0, from = 0; index < count; ++index, from = combo_next())
+	{
+	  form_command(from);
+	  h = history_find(cmd_buf, 0);
+	  cost = h ? h -> msec + 1 : mean; /* even the fastest command costs something */
+	  if (pass == 0)
+	    {
+	      if (h)
+		{
+		  total += cost;
+		  ++known;
+		}
+	      continue;
+	    }
+	  if (sum < total * (shard - 1) / shard_count)
+	    *begin = index + 1;
+	  if (sum < total * shard / shard_count)
+	    *end = index + 1;
+	  sum += cost;
+	}
+      if (pass == 0)
+	{
+	  mean = known ? total / known : 1;
+	  total += (count - known) * mean;
+	}
+    }
+  if (shard == 1)
+    *begin = 0;
+  if (shard == shard_count)
+    *end = count;
+}
+
+void combo_init(void)
+{
+  int i;
+
+  combo_total = 1;
+  for (i = option_count - 1; i >= 0; --i)
+    {
+      combo_stride[i] = combo_total;
+      if (passed_options[i].val_cnt
+	  && combo_total > UINT64_MAX / passed_options[i].val_cnt)
+	{
+	  /* the strides of the options left would overflow as well */
+	  combo_overflow = 1;
+	  return;
+	}
+      combo_total *= passed_options[i].val_cnt;
+    }
+}
+
+uint64_t combo_count(void)
+{
+  if (plan_rows)
+    return plan_jobs;
+  if (combo_overflow)
+    error_exit("Too many combinations\n");
+  return combo_total;
+}
+
+int combo_at(uint64_t index)
+{
+  int i, changed = option_count, value;
+
+  if (plan_rows)
+    return plan_row(index);
+  for (i = 0; i < option_count; ++i)
+    {
+      value = index / combo_stride[i];
+      index %= combo_stride[i];
+      if (value != cur_set[i] && changed == option_count)
+	changed = i;
+      cur_set[i] = value;
+    }
+  return changed;
+}
+
+uint64_t combo_index(void)
+{
+  uint64_t index = 0;
+  int i;
+
+  for (i = 0; i < option_count; ++i)
+    index += cur_set[i] * combo_stride[i];
+  return index;
+}
+
+int combo_next(void)
+{
+  int i;
+
+  for (i = option_count - 1; i >= 0; --i)
+    {
+      if (++cur_set[i] < passed_options[i].val_cnt)
+	return i;
+      cur_set[i] = 0;
+    }
+  return -1;
+}
+
+void run_combination(int from)
+{
+  unsigned char key[SHA256_LEN], hash[SHA256_LEN], *stamp = NULL;
+  struct dedup *dedup = NULL;
+  struct duplicate *dup, cur;
+
+  sigterm_check();
+  arena_reset(&scratch_arena);
+  form_command(from);
+  if (if_changed && outfile_base)
+    {
+      command_hash(hash);
+      stamp = hash;
+    }
+  if ((deps || stamp) && outfile_base
+      && (!deps || deps_fresh()) && (!stamp || stamp_fresh(hash)))
+    {
+      if (dry_run)
+	return;
+      printf("Up to date... %s\n", cmd_buf);
+      ++total_jobs;
+      if (dedup_outputs)
+	dedup_output(file_buf);
+      return;
+    }
+  if (dry_run)
+    {
+      puts(cmd_buf);
+      return;
+    }
+
+  /* the output is about to be rewritten, the old
+     stamp must not survive an interrupted run */
+  if (stamp)
+    unlink(stamp_buf);
+  /* a hard link might be written through */
+  if (dedup_outputs == LINK_HARDLINK)
+    unlink(file_buf);
+
+  if (!cache_dir && !dedup_commands)
+    {
+      run_job(argv_buf, cmd_buf, NULL, stamp, NULL);
+      return;
+    }
+
+  cache_key(key);
+  if (dedup_commands)
+    {
+      dedup = dedup_find(key);
+      if (dedup -> file) /* the same command has been run before */
+	{
+	  cur.file = file_buf;
+	  cur.cmd = cmd_buf;
+	  if ((cur.stamped = stamp != NULL))
+	    memcpy(cur.hash, stamp, SHA256_LEN);
+	  if (dedup -> state != DEDUP_RUNNING)
+	    {
+	      dedup_copy(dedup, &cur);
+	      return;
+	    }
+	  if (!(dup = malloc(sizeof(struct duplicate)))
+	      || !(dup -> file = strdup(file_buf)) || !(dup -> cmd = strdup(cmd_buf)))
+	    errno_exit("Can't allocate duplicate\n");
+	  dup -> stamped = cur.stamped;
+	  memcpy(dup -> hash, cur.hash, SHA256_LEN);
+	  dup -> next = dedup -> pending;
+	  dedup -> pending = dup;
+	  return;
+	}
+      if (!(dedup -> file = strdup(file_buf)))
+	errno_exit("Can't allocate `%s'\n", file_buf);
+    }
+
+  if (cache_dir && cache_sources(key) == -1)
+    {
+      /* the backend is to tell what's wrong */
+      run_job(argv_buf, cmd_buf, NULL, stamp, dedup);
+      return;
+    }
+  if (cache_dir && cache_fetch(key, file_buf))
+    {
+      printf("Cached... %s\n", cmd_buf);
+      ++total_jobs;
+      if (stamp)
+	stamp_write(file_buf, stamp);
+      if (dedup_outputs)
+	dedup_output(file_buf);
+      if (dedup)
+	dedup_done(dedup, DEDUP_DONE);
+      return;
+    }
+  run_job(argv_buf, cmd_buf, cache_dir ? key : NULL, stamp, dedup);
+}
+
+struct dedup *dedup_find(const unsigned char *key)
+{
+  struct dedup **d;
+
+  /* the key is a hash already */
+  for (d = &dedup_tab[(key[0] << 8 | key[1]) % DEDUP_BUCKETS]; *d; d = &(*d) -> next)
+    if (!memcmp((*d) -> key, key, SHA256_LEN))
+      return *d;
+
+  if (!(*d = calloc(1, sizeof(struct dedup))))
+    errno_exit("Can't allocate dedup entry\n");
+  memcpy((*d) -> key, key, SHA256_LEN);
+  (*d) -> state = DEDUP_RUNNING;
+  return *d;
+}
+
+void dedup_copy(const struct dedup *dedup, const struct duplicate *dup)
+{
+  char src[PATH_MAX], dst[PATH_MAX];
+
+  ++total_jobs;
+  if (dedup -> state == DEDUP_CANCELLED)
+    {
+      printf("Cancelled... %s\n", dup -> cmd);
+      return;
+    }
+  if (dedup -> state == DEDUP_FAILED)
+    {
+      printf("Failed as duplicate... %s\n", dup -> cmd);
+      ++failed_jobs;
+      return;
+    }
+
+  if (clone_file(dedup -> file, dup -> file) == -1)
+    {
+      fprintf(stderr, "Can't copy `%s' to `%s': %s\n",
+	      dedup -> file, dup -> file, strerror(errno));
+      ++failed_jobs;
+      return;
+    }
+  if (deps)
+    {
+      snprintf(src, sizeof(src), "%s.d", dedup -> file);
+      snprintf(dst, sizeof(dst), "%s.d", dup -> file);
+      depfile_restore(src, dst, dup -> file);
+    }
+  if (dup -> stamped)
+    stamp_write(dup -> file, dup -> hash);
+  printf("Duplicate... %s\n", dup -> cmd);
+  if (dedup_outputs)
+    dedup_output(dup -> file);
+}
+
+void dedup_output(const char *file)
+{
+  unsigned char digest[SHA256_LEN];
+  struct output **o;
+  struct stat st, orig;
+
+  if (sha256_file(file, digest) == -1 || stat(file, &st) == -1)
+    return;
+  for (o = &output_tab[(digest[0] << 8 | digest[1]) % DEDUP_BUCKETS]; *o; o = &(*o) -> next)
+    if (!memcmp((*o) -> digest, digest, SHA256_LEN))
+      {
+	if (stat((*o) -> file, &orig) == -1
+	    || (orig.st_dev == st.st_dev && orig.st_ino == st.st_ino) /* linked already */
+	    || !strcmp((*o) -> file, file))
+	  return;
+	if (link_file((*o) -> file, file, dedup_outputs == LINK_HARDLINK) == 0)
+	  {
+	    ++outputs_linked;
+	    bytes_saved += st.st_size;
+	  }
+	return;
+      }
+
+  if (!(*o = calloc(1, sizeof(struct output))) || !((*o) -> file = strdup(file)))
+    errno_exit("Can't allocate output entry\n");
+  memcpy((*o) -> digest, digest, SHA256_LEN);
+}
+
+const char *pp_token(const char *fname)
+{
+  static const char *const prefixes[] = {"-g", "-W", "-fdiagnostics-", NULL},
+    *const names[] = {"-w", "-c", "-S", "-pipe", "-fverbose-asm",
+		      "-fomit-frame-pointer", "-fno-omit-frame-pointer",
+		      "-ffunction-sections", "-fdata-sections", NULL};
+  int i;
+
+  if (!fname || !*fname)
+    return "";
+  for (i = 0; prefixes[i]; ++i)
+    if (!strncmp(fname, prefixes[i], strlen(prefixes[i]))
+	&& strncmp(fname, "-Wp,", 4)) /* options of the preprocessor itself */
+      return "";
+  for (i = 0; names[i]; ++i)
+    if (!strcmp(fname, names[i]))
+      return "";
+
+  /* -O levels only decide on __OPTIMIZE__, __OPTIMIZE_SIZE__
+     and __NO_INLINE__, but -Ofast defines __FAST_MATH__ too */
+  if (!strcmp(fname, "-O0"))
+    return "";
+  if (!strcmp(fname, "-O") || !strcmp(fname, "-O1")
+      || !strcmp(fname, "-O2") || !strcmp(fname, "-O3"))
+    return "-O";
+  if (!strcmp(fname, "-Os") || !strcmp(fname, "-Oz"))
+    return "-Os";
+  return fname;
+}
+
+const char *pch_token(const char *fname)
+{
+  static const char *const names[] = {"-w", "-c", "-S", "-pipe", NULL};
+  int i;
+
+  if (!fname || !*fname
+      || (!strncmp(fname, "-W", 2) && strncmp(fname, "-Wp,", 4))
+      || !strncmp(fname, "-fdiagnostics-", 14))
+    return "";
+  for (i = 0; names[i]; ++i)
+    if (!strcmp(fname, names[i]))
+      return "";
+  return fname;
+}
+
+int option_value(const char *arg)
+{
+  static const char *const names[] = {"-I", "-D", "-U", "-L", "-include", "-imacros",
+				       "-isystem", "-iquote", "-idirafter", "-iprefix",
+				       "-iwithprefix", "-iwithprefixbefore", "-isysroot",
+				       "-imultilib", "--sysroot", "-MF", "-MT", "-MQ", "-x",
+				       "-o", "-Xpreprocessor", "-Xassembler", "-Xlinker",
+				       "-Xclang", "--param", "-target", "-arch", NULL};
+  int i;
+
+  for (i = 0; names[i]; ++i)
+    if (!strcmp(arg, names[i]))
+      return 1;
+  return 0;
+}
+
+void group_init(const char *(*token)(const char *))
+{
+  struct option_spec *opt;
+  int i, v, w;
+
+  group_count = 1;
+  for (i = option_count - 1; i >= 0; --i)
+    {
+      opt = &passed_options[i];
+      for (opt -> group_cnt = 0, v = 0; v < opt -> val_cnt; ++v)
+	{
+	  for (w = 0; w < v; ++w)
+	    if (!strcmp(token(opt -> opt_val[w].fname), token(opt -> opt_val[v].fname)))
+	      break;
+	  opt -> opt_val[v].group = w < v ? opt -> opt_val[w].group : opt -> group_cnt++;
+	}
+      group_stride[i] = group_count;
+      if (opt -> group_cnt && group_count > UINT64_MAX / opt -> group_cnt)
+	error_exit("Too many groups of combinations\n");
+      group_count *= opt -> group_cnt;
+    }
+}
+
+uint64_t group_index(void)
+{
+  uint64_t n = 0;
+  int i;
+
+  for (i = 0; i < option_count; ++i)
+    n += passed_options[i].opt_val[cur_set[i]].group * group_stride[i];
+  return n;
+}
+
+void group_command(uint64_t n, const char *(*token)(const char *),
+		   char **args, int *argc, char *cmd, int *ind, size_t size)
+{
+  struct option_spec *opt;
+  int i, v, d;
+
+  for (i = 0; i < option_count; ++i)
+    {
+      opt = &passed_options[i];
+      d = n / group_stride[i] % opt -> group_cnt;
+      for (v = 0; opt -> opt_val[v].group != d; ++v)
+	;
+      if (!*token(opt -> opt_val[v].fname))
+	continue;
+      args[(*argc)++] = opt -> opt_val[v].fname;
+      str_write(cmd, ind, size - *ind, " %s", opt -> opt_val[v].fname);
+    }
+}
+
+void tmp_init(void)
+{
+  char tmpl[PATH_MAX];
+  const char *tmp;
+
+  if (tmp_dir) /* it's shared */
+    return;
+  if (!(tmp = getenv("TMPDIR")) || !*tmp)
+    tmp = "/tmp";
+  snprintf(tmpl, PATH_MAX, "%s/ccgen.XXXXXX", tmp);
+  if (!mkdtemp(tmpl) || !(tmp_dir = strdup(tmpl)))
+    errno_exit("Can't create temporary directory\n");
+  atexit(tmp_cleanup);
+}
+
+void tmp_cleanup(void)
+{
+  char path[PATH_MAX];
+  struct dirent *ent;
+  DIR *dir;
+
+  if (!tmp_dir)
+    return;
+  if ((dir = opendir(tmp_dir)))
+    {
+      while ((ent = readdir(dir)))
+	if (strcmp(ent -> d_name, ".") && strcmp(ent -> d_name, ".."))
+	  {
+	    snprintf(path, PATH_MAX, "%s/%s", tmp_dir, ent -> d_name);
+	    unlink(path);
+	  }
+      closedir(dir);
+    }
+  rmdir(tmp_dir);
+  tmp_dir = NULL;
+}
+
+void response_init(void)
+{
+  const char *name;
+  char path[PATH_MAX];
+  size_t len = 0, ind = 0;
+  int i, fd;
+
+  if (response_file == RESPONSE_NEVER)
+    return;
+  /* options can't be moved past the ones, which
+     differ from a combination to another */
+  for (rsp_from = option_count; rsp_from > 0 && passed_options[rsp_from - 1].val_cnt == 1; --rsp_from)
+    ;
+  for (i = rsp_from; i < option_count; ++i)
+    len += 2 * strlen(passed_options[i].opt_val[0].fname) + 3;
+  for (i = 0; i < arg_count; ++i)
+    len += 2 * strlen(arguments[i]) + 3;
+  rsp_text = arena_alloc(&spec_arena, len + 1);
+
+  for (i = rsp_from; i < option_count; ++i)
+    if (passed_options[i].opt_val[0].cmd_len)
+      response_quote(rsp_text, &ind, passed_options[i].opt_val[0].fname);
+  for (i = 0; i < arg_count; ++i)
+    if (!preprocess_once || i != pp_source)
+      response_quote(rsp_text, &ind, arguments[i]);
+
+  name = strrchr(backend, '/') ? strrchr(backend, '/') + 1 : backend;
+  if (!ind || (response_file == RESPONSE_AUTO
+	       && (ind < RESPONSE_FILE_MIN
+		   || (!strstr(name, "cc") && !strstr(name, "++") && !strstr(name, "clang")))))
+    return;
+
+  tmp_init();
+  snprintf(path, PATH_MAX, "%s/common.rsp", tmp_dir);
+  if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1
+      || write(fd, rsp_text, ind) != (ssize_t) ind || close(fd) == -1)
+    errno_exit("Can't write `%s'\n", path);
+  rsp_arg = arena_alloc(&spec_arena, strlen(path) + 2);
+  sprintf(rsp_arg, "@%s", path);
+}
+
+void response_quote(char *text, size_t *ind, const char *arg)
+{
+  if (!*arg)
+    {
+      text[(*ind)++] = '\'';
+      text[(*ind)++] = '\'';
+    }
+  for (; *arg; ++arg)
+    {
+      if (isspace((unsigned char) *arg) || *arg == '\'' || *arg == '"' || *arg == '\\')
+	text[(*ind)++] = '\\';
+      text[(*ind)++] = *arg;
+    }
+  text[(*ind)++] = '\n';
+  text[*ind] = '\0';
+}
+
+void preprocess_init(void)
+{
+  static const char *const cxx[] = {"cc", "cp", "cxx", "cpp", "CPP", "c++", "C", NULL};
+  char *ext;
+  int i, j;
+
+  if (deps)
+    error_exit("--preprocess-once can't be used together with --deps\n");
+  if (pch_header)
+    error_exit("--preprocess-once can't be used together with --pch\n");
+  for (i = 0; i < arg_count; ++i)
+    {
+      if (arguments[i][0] == '-' || !(ext = strrchr(arguments[i], '.')))
+	continue;
+      for (j = 0; cxx[j] && strcmp(ext + 1, cxx[j]); ++j)
+	;
+      if (strcmp(ext + 1, "c") && !cxx[j])
+	continue;
+      if (pp_source != -1)
+	error_exit("--preprocess-once needs a single source, `%s' and `%s' are given\n",
+		   arguments[pp_source], arguments[i]);
+      pp_source = i;
+      pp_ext = cxx[j] ? "ii" : "i";
+    }
+  if (pp_source == -1)
+    error_exit("--preprocess-once needs a C or C++ source among the arguments\n");
+
+  group_init(pp_token);
+  tmp_init();
+}
+
+void preprocess_all(void)
+{
+  char **args = argv_buf, *cmd = cmd_buf, path[PATH_MAX];
+  uint64_t n;
+  int argc, ind;
+
+  helper_jobs = 1;
+  for (n = 0; n < group_count && (!fail_fast || !failed_helpers); ++n)
+    {
+      argc = ind = 0;
+      args[argc++] = backend;
+      str_write(cmd, &ind, cmd_size - ind, "%s", backend);
+      group_command(n, pp_token, args, &argc, cmd, &ind, cmd_size);
+      preprocess_path(n, path);
+      str_write(cmd, &ind, cmd_size - ind, " -E -o %s", path);
+      args[argc++] = "-E";
+      args[argc++] = "-o";
+      args[argc++] = path;
+      str_append(cmd, &ind, cmd_size - ind, args_frag, args_len);
+      memcpy(args + argc, arguments, arg_count * sizeof(char *));
+      args[argc + arg_count] = NULL;
+      run_job(args, cmd, NULL, NULL, NULL);
+    }
+
+  while (running_jobs)
+    reap_job(1);
+  helper_jobs = 0;
+}
+
+void preprocess_path(uint64_t n, char *path)
+{
+  snprintf(path, PATH_MAX, "%s/%llu.%s", tmp_dir, (unsigned long long) n, pp_ext);
+}
+
+void pch_init(void)
+{
+  const char *name;
+
+  if (deps)
+    error_exit("--pch can't be used together with --deps\n");
+  if (access(pch_header, R_OK) == -1)
+    errno_exit("Can't read `%s'\n", pch_header);
+  name = strrchr(backend, '/') ? strrchr(backend, '/') + 1 : backend;
+  pch_clang = strstr(name, "clang") != NULL;
+
+  group_init(pch_token);
+  tmp_init();
+}
+
+void pch_all(void)
+{
+  static const char *const cxx[] = {"hh", "hpp", "hxx", "H", "h++", NULL};
+  char **args = argv_buf, *cmd = cmd_buf, path[PATH_MAX], out[PATH_MAX + 4], real[PATH_MAX];
+  const char *name, *ext, *lang = "c-header";
+  uint64_t n;
+  int i, argc, ind;
+
+  name = strrchr(backend, '/') ? strrchr(backend, '/') + 1 : backend;
+  if (strstr(name, "++"))
+    lang = "c++-header";
+  else if ((ext = strrchr(pch_header, '.')))
+    for (i = 0; cxx[i]; ++i)
+      if (!strcmp(ext + 1, cxx[i]))
+	lang = "c++-header";
+  if (!realpath(pch_header, real))
+    errno_exit("Can't find `%s'\n", pch_header);
+
+  helper_jobs = 1;
+  for (n = 0; n < group_count && (!fail_fast || !failed_helpers); ++n)
+    {
+      argc = ind = 0;
+      args[argc++] = backend;
+      str_write(cmd, &ind, cmd_size - ind, "%s", backend);
+      group_command(n, pch_token, args, &argc, cmd, &ind, cmd_size);
+      /* options among the arguments (-I dir, -D...) count, the sources don't */
+      for (i = 0; i < arg_count; ++i)
+	if (arguments[i][0] == '-' || (i && option_value(arguments[i - 1])))
+	  {
+	    args[argc++] = arguments[i];
+	    str_write(cmd, &ind, cmd_size - ind, " %s", arguments[i]);
+	  }
+
+      pch_path(n, path);
+      if (pch_clang)
+	snprintf(out, sizeof(out), "%s", path);
+      else
+	{
+	  /* GCC looks for path.gch, and takes the
+	     header itself if it can't use that one */
+	  snprintf(out, sizeof(out), "%s.gch", path);
+	  if (symlink(real, path) == -1)
+	    errno_exit("Can't link `%s'\n", path);
+	}
+      str_write(cmd, &ind, cmd_size - ind, " -x %s %s -o %s", lang, pch_header, out);
+      args[argc++] = "-x";
+      args[argc++] = (char *) lang;
+      args[argc++] = pch_header;
+      args[argc++] = "-o";
+      args[argc++] = out;
+      args[argc] = NULL;
+      run_job(args, cmd, NULL, NULL, NULL);
+    }
+
+  while (running_jobs)
+    reap_job(1);
+  helper_jobs = 0;
+}
+
+void pch_path(uint64_t n, char *path)
+{
+  snprintf(path, PATH_MAX, "%s/%llu.%s", tmp_dir, (unsigned long long) n, pch_clang ? "pch" : "h");
+}
+
+const char *stable_arg(int i)
+{
+  if (argv_buf[i] == pp_buf)
+    return arguments[pp_source];
+  if (argv_buf[i] == pch_buf)
+    return pch_header;
+  if (argv_buf[i] == rsp_arg)
+    return rsp_text;
+  return argv_buf[i];
+}
+
+int link_file(const char *src, const char *dst, int hard)
+{
+  char tmp[PATH_MAX];
+  int in, out, err = -1;
+  struct stat st;
+
+  if (snprintf(tmp, PATH_MAX, "%s.%d.tmp", dst, (int) getpid()) >= PATH_MAX)
+    {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+  if (hard)
+    err = link(src, tmp);
+  else
+    {
+      if ((in = open(src, O_RDONLY | O_CLOEXEC)) == -1)
+	return -1;
+      if (fstat(in, &st) == 0
+	  && (out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 0777)) != -1)
+	{
+#ifdef FICLONE
+	  err = ioctl(out, FICLONE, in);
+#endif
+	  if (close(out) == -1)
+	    err = -1;
+	}
+      close(in);
+    }
+
+  if (err == -1 || rename(tmp, dst) == -1)
+    {
+      unlink(tmp);
+      return -1;
+    }
+  return 0;
+}
+
+void dedup_done(struct dedup *dedup, int state)
+{
+  struct duplicate *dup;
+
+  dedup -> state = state;
+  while ((dup = dedup -> pending))
+    {
+      dedup -> pending = dup -> next;
+      dedup_copy(dedup, dup);
+      free(dup -> file);
+      free(dup -> cmd);
+      free(dup);
+    }
+}
+
+void plan_emit(const char *path)
+{
+  static const char zero[8];
+  struct plan_header hdr;
+  struct plan_option *opts;
+  struct plan_value *vals;
+  uint32_t *args, *table;
+  char *strings;
+  unsigned char *row;
+  uint64_t count, n;
+  size_t size, max = 0, pos;
+  int i, j, v = 0;
+  FILE *fp;
+
+  if (shard_count)
+    error_exit("--emit-plan plans all of the combinations, use --shard with --run-plan\n");
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, PLAN_MAGIC, sizeof(hdr.magic));
+  hdr.version = PLAN_VERSION;
+  hdr.byte_order = 0x01020304;
+  hdr.option_count = option_count;
+  hdr.arg_count = arg_count;
+  for (i = 0; i < option_count; ++i)
+    {
+      hdr.value_count += passed_options[i].val_cnt;
+      if ((size_t) passed_options[i].val_cnt > max)
+	max = passed_options[i].val_cnt;
+    }
+  hdr.index_size = max <= 0x100 ? 1 : max <= 0x10000 ? 2 : 4;
+  for (i = 0; i < option_count; ++i)
+    if (!passed_options[i].val_cnt)
+      break;
+  hdr.job_count = count = i < option_count ? 0 : combo_count();
+
+  /* there is room for every string, should none of them repeat */
+  size = 3 + 2 * hdr.value_count + arg_count;
+  n = strlen(backend) + 1 + (outfile_base ? strlen(outfile_base) + 1 : 0)
+    + (extension ? strlen(extension) + 1 : 0);
+  for (i = 0; i < option_count; ++i)
+    for (j = 0; j < passed_options[i].val_cnt; ++j)
+      n += strlen(passed_options[i].opt_val[j].fname) + 1
+	+ (passed_options[i].opt_val[j].iname ? strlen(passed_options[i].opt_val[j].iname) + 1 : 0);
+  for (i = 0; i < arg_count; ++i)
+    n += strlen(arguments[i]) + 1;
+  strings = arena_alloc(&spec_arena, n);
+  for (pos = 1; pos < 2 * size; pos *= 2)
+    ;
+  table = arena_alloc(&spec_arena, pos * sizeof(uint32_t));
+  memset(table, 0xff, pos * sizeof(uint32_t));
+  size = pos;
+
+  opts = arena_alloc(&spec_arena, option_count * sizeof(struct plan_option));
+  vals = arena_alloc(&spec_arena, hdr.value_count * sizeof(struct plan_value));
+  args = arena_alloc(&spec_arena, arg_count * sizeof(uint32_t));
+  hdr.backend = plan_string(backend, strings, &hdr.strings_size, table, size);
+  hdr.outfile_base = plan_string(outfile_base, strings, &hdr.strings_size, table, size);
+  hdr.extension = plan_string(extension, strings, &hdr.strings_size, table, size);
+  for (i = 0; i < option_count; ++i)
+    {
+      opts[i].first = v;
+      opts[i].count = passed_options[i].val_cnt;
+      for (j = 0; j < passed_options[i].val_cnt; ++j, ++v)
+	{
+	  vals[v].fname = plan_string(passed_options[i].opt_val[j].fname,
+				      strings, &hdr.strings_size, table, size);
+	  vals[v].iname = plan_string(passed_options[i].opt_val[j].iname,
+				      strings, &hdr.strings_size, table, size);
+	}
+    }
+  for (i = 0; i < arg_count; ++i)
+    args[i] = plan_string(arguments[i], strings, &hdr.strings_size, table, size);
+
+  hdr.strings = sizeof(hdr);
+  hdr.options = (hdr.strings + hdr.strings_size + 7) & ~7ULL;
+  hdr.values = hdr.options + option_count * sizeof(struct plan_option);
+  hdr.args = hdr.values + hdr.value_count * sizeof(struct plan_value);
+  hdr.jobs = (hdr.args + arg_count * sizeof(uint32_t) + 7) & ~7ULL;
+
+  if (!(fp = fopen(path, "wb")))
+    errno_exit("Can't write `%s'\n", path);
+  fwrite(&hdr, sizeof(hdr), 1, fp);
+  fwrite(strings, 1, hdr.strings_size, fp);
+  fwrite(zero, 1, hdr.options - hdr.strings - hdr.strings_size, fp);
+  fwrite(opts, sizeof(struct plan_option), option_count, fp);
+  fwrite(vals, sizeof(struct plan_value), hdr.value_count, fp);
+  fwrite(args, sizeof(uint32_t), arg_count, fp);
+  fwrite(zero, 1, hdr.jobs - hdr.args - arg_count * sizeof(uint32_t), fp);
+
+  row = arena_alloc(&spec_arena, option_count * hdr.index_size + 1);
+  memset(cur_set, 0, option_count * sizeof(int));
+  for (n = 0; n < count; ++n, combo_next())
+    {
+      for (i = 0; i < option_count; ++i)
+	if (hdr.index_size == 1)
+	  row[i] = cur_set[i];
+	else if (hdr.index_size == 2)
+	  ((uint16_t *) row)[i] = cur_set[i];
+	else
+	  ((uint32_t *) row)[i] = cur_set[i];
+      fwrite(row, hdr.index_size, option_count, fp);
+    }
+
+  if (ferror(fp) | fclose(fp))
+    errno_exit("Can't write `%s'\n", path);
+  printf("%llu combinations planned in `%s'\n", (unsigned long long) count, path);
+}
+
+uint32_t plan_string(const char *str, char *strings, uint64_t *len,
+		     uint32_t *table, size_t size)
+{
+  size_t h = 5381;
+  const char *p;
+
+  if (!str)
+    return PLAN_NONE;
+  for (p = str; *p; ++p)
+    h = h * 33 + (unsigned char) *p;
+  for (h &= size - 1; table[h] != PLAN_NONE; h = (h + 1) & (size - 1))
+    if (!strcmp(strings + table[h], str))
+      return table[h];
+
+  table[h] = *len;
+  memcpy(strings + *len, str, p - str + 1);
+  *len += p - str + 1;
+  return table[h];
+}
+
+void plan_load(const char *path)
+{
+  const struct plan_header *hdr;
+  const struct plan_option *opts;
+  const struct plan_value *vals;
+  const uint32_t *args;
+  const char *map, *strings;
+  struct stat st;
+  uint64_t row_size;
+  uint32_t i, j;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1 || fstat(fd, &st) == -1)
+    errno_exit("Can't open `%s'\n", path);
+  if ((size_t) st.st_size < sizeof(struct plan_header))
+    error_exit("`%s' isn't a plan\n", path);
+  if ((map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+    errno_exit("Can't map `%s'\n", path);
+  close(fd);
+
+  hdr = (const struct plan_header *) map;
+  if (memcmp(hdr -> magic, PLAN_MAGIC, sizeof(hdr -> magic)))
+    error_exit("`%s' isn't a plan\n", path);
+  if (hdr -> version != PLAN_VERSION || hdr -> byte_order != 0x01020304)
+    error_exit("`%s' is a plan of another version or byte order\n", path);
+  row_size = (uint64_t) hdr -> option_count * hdr -> index_size;
+  /* the tables are in order, so the end of the previous one is checked
+     by the beginning of the next one, and all of them fit the file */
+  if (!hdr -> strings_size || hdr -> strings < sizeof(struct plan_header)
+      || hdr -> options < hdr -> strings + hdr -> strings_size
+      || hdr -> values != hdr -> options + hdr -> option_count * sizeof(struct plan_option)
+      || hdr -> args != hdr -> values + hdr -> value_count * sizeof(struct plan_value)
+      || hdr -> jobs < hdr -> args + hdr -> arg_count * sizeof(uint32_t)
+      || hdr -> jobs > (uint64_t) st.st_size || hdr -> options % 8 || hdr -> jobs % 8
+      || (hdr -> index_size != 1 && hdr -> index_size != 2 && hdr -> index_size != 4)
+      || (row_size && hdr -> job_count > (st.st_size - hdr -> jobs) / row_size)
+      || map[hdr -> strings + hdr -> strings_size - 1] != '\0')
+    error_exit("`%s' is a corrupt plan\n", path);
+
+  strings = map + hdr -> strings;
+  opts = (const struct plan_option *) (map + hdr -> options);
+  vals = (const struct plan_value *) (map + hdr -> values);
+  args = (const uint32_t *) (map + hdr -> args);
+#define PLAN_STRING(off) ((off) == PLAN_NONE ? NULL			\
+			  : (off) < hdr -> strings_size ? (char *) strings + (off) \
+			  : (error_exit("`%s' is a corrupt plan\n", path), NULL))
+
+  option_count = option_cap = hdr -> option_count;
+  passed_options = arena_alloc(&spec_arena, option_count * sizeof(struct option_spec));
+  for (i = 0; i < hdr -> option_count; ++i)
+    {
+      if (opts[i].first > hdr -> value_count || opts[i].count > hdr -> value_count - opts[i].first)
+	error_exit("`%s' is a corrupt plan\n", path);
+      passed_options[i].val_cnt = opts[i].count;
+      passed_options[i].opt_val = arena_alloc(&spec_arena, opts[i].count * sizeof(struct option_value));
+      for (j = 0; j < opts[i].count; ++j)
+	{
+	  if (!(passed_options[i].opt_val[j].fname = PLAN_STRING(vals[opts[i].first + j].fname)))
+	    error_exit("`%s' is a corrupt plan\n", path);
+	  passed_options[i].opt_val[j].iname = PLAN_STRING(vals[opts[i].first + j].iname);
+	}
+    }
+  arg_count = hdr -> arg_count;
+  arguments = arena_alloc(&spec_arena, (arg_count + 1) * sizeof(char *));
+  for (i = 0; i < hdr -> arg_count; ++i)
+    if (!(arguments[i] = PLAN_STRING(args[i])))
+      error_exit("`%s' is a corrupt plan\n", path);
+  if (!(backend = PLAN_STRING(hdr -> backend)))
+    error_exit("`%s' is a corrupt plan\n", path);
+  outfile_base = PLAN_STRING(hdr -> outfile_base);
+  extension = PLAN_STRING(hdr -> extension);
+#undef PLAN_STRING
+
+  plan_rows = (const unsigned char *) map + hdr -> jobs;
+  plan_jobs = hdr -> job_count;
+  plan_index_size = hdr -> index_size;
+}
+
+int plan_row(uint64_t index)
+{
+  const unsigned char *row = plan_rows + index * option_count * plan_index_size;
+  int i, changed = option_count, value;
+
+  if (index >= plan_jobs)
+    return option_count;
+  for (i = 0; i < option_count; ++i)
+    {
+      if (plan_index_size == 1)
+	value = row[i];
+      else if (plan_index_size == 2)
+	value = ((const uint16_t *) row)[i];
+      else
+	value = ((const uint32_t *) row)[i];
+      if (value >= passed_options[i].val_cnt)
+	error_exit("Corrupt plan row %llu\n", (unsigned long long) index);
+      if (value != cur_set[i] && changed == option_count)
+	changed = i;
+      cur_set[i] = value;
+    }
+  return changed;
+}
+
+void stream_init(void)
+{
+  if (history_file)
+    error_exit("--stream can't be used together with --history\n");
+  if (shard_count)
+    error_exit("--stream can't be used together with --shard\n");
+  if (dedup_commands || dedup_outputs)
+    error_exit("--stream can't be used together with --dedup-commands or --dedup-outputs\n");
+  if (preprocess_once || pch_header)
+    error_exit("--stream can't be used together with --preprocess-once or --pch\n");
+}
+
+void buffers_init(void)
+{
+  size_t max_cmd, max_file;
+  int i, j;
+
+  file_size = (outfile_base ? strlen(outfile_base) : 0) + 1;
+  cmd_size = strlen(backend) + args_len + 1;
+  for (i = 0; i < option_count; ++i)
+    {
+      max_cmd = max_file = 0;
+      for (j = 0; j < passed_options[i].val_cnt; ++j)
+	{
+	  if ((size_t) passed_options[i].opt_val[j].cmd_len > max_cmd)
+	    max_cmd = passed_options[i].opt_val[j].cmd_len;
+	  if ((size_t) passed_options[i].opt_val[j].file_len > max_file)
+	    max_file = passed_options[i].opt_val[j].file_len;
+	}
+      cmd_size += max_cmd;
+      file_size += max_file;
+    }
+  if (extension)
+    file_size += 1 + strlen(extension);
+  if (pch_header)
+    cmd_size += strlen(" -include ") + strlen(pch_header);
+  if (outfile_base)
+    cmd_size += strlen(" -o ") + file_size;
+  if (deps)
+    cmd_size += strlen(" -MD -MF ") + file_size + 2;
+  if (preprocess_once || pch_header) /* the commands that prepare the groups */
+    cmd_size += 2 * PATH_MAX;
+  /* backend, options, -include pch, -o file, -MD -MF depfile, arguments and NULL */
+  argv_size = option_count + arg_count + 9;
+
+  combo_stride = arena_alloc(&spec_arena, option_count * sizeof(uint64_t));
+  combo_init();
+  group_stride = arena_alloc(&spec_arena, option_count * sizeof(uint64_t));
+  argv_buf = arena_alloc(&spec_arena, argv_size * sizeof(char *));
+  cur_set = arena_alloc(&spec_arena, option_count * sizeof(int));
+  cmd_mark = arena_alloc(&spec_arena, (option_count + 1) * sizeof(int));
+  file_mark = arena_alloc(&spec_arena, (option_count + 1) * sizeof(int));
+  argv_mark = arena_alloc(&spec_arena, (option_count + 1) * sizeof(int));
+  cmd_buf = arena_alloc(&spec_arena, cmd_size);
+  file_buf = arena_alloc(&spec_arena, file_size);
+  dep_buf = arena_alloc(&spec_arena, file_size + 2);
+  stamp_buf = arena_alloc(&spec_arena, file_size + 4);
+  for (i = 0; i < max_jobs; ++i)
+    {
+      jobs[i].cmd = arena_alloc(&spec_arena, cmd_size);
+      jobs[i].file = arena_alloc(&spec_arena, file_size);
+    }
+}
+
+void form_command(int from)
+{
+  int i, cmd_ind, file_ind, argv_ind;
+  struct option_value *cur_val;
+
+  if (!from)
+    {
+      cmd_ind = file_ind = argv_ind = 0;
+      str_write(cmd_buf,
+		&cmd_ind,
+		cmd_size - cmd_ind,
+		"%s", backend);
+      argv_buf[argv_ind++] = backend;
+
+      if (outfile_base)
+	str_write(file_buf,
+		  &file_ind,
+		  file_size - file_ind,
+		  "%s", outfile_base);
+      cmd_mark[0] = cmd_ind;
+      file_mark[0] = file_ind;
+      argv_mark[0] = argv_ind;
+    }
+
+  /* everything before the option _from_ is the same
+     as in the previous combination */
+  cmd_ind = cmd_mark[from];
+  file_ind = file_mark[from];
+  argv_ind = argv_mark[from];
+
+  for (i = from; i < option_count; ++i)
+    {
+      cur_val = &passed_options[i].opt_val[cur_set[i]];
+      if (cur_val -> cmd_len)
+	{
+	  str_append(cmd_buf,
+		     &cmd_ind,
+		     cmd_size - cmd_ind,
+		     cur_val -> cmd_frag, cur_val -> cmd_len);
+	  if (!rsp_arg || i < rsp_from)
+	    argv_buf[argv_ind++] = cur_val -> fname;
+	}
+      if (outfile_base && cur_val -> file_len)
+	str_append(file_buf,
+		   &file_ind,
+		   file_size - file_ind,
+		   cur_val -> file_frag, cur_val -> file_len);
+      cmd_mark[i + 1] = cmd_ind;
+      file_mark[i + 1] = file_ind;
+      argv_mark[i + 1] = argv_ind;
+    }
+
+  if (pch_header)
+    {
+      pch_path(group_index(), pch_buf);
+      str_write(cmd_buf,
+		&cmd_ind,
+		cmd_size - cmd_ind,
+		" -include %s", pch_header);
+      argv_buf[argv_ind++] = pch_clang ? "-include-pch" : "-include";
+      argv_buf[argv_ind++] = pch_buf;
+    }
+
+  if (outfile_base)
+    {
+      if (extension)
+	str_write(file_buf,
+		  &file_ind,
+		  file_size - file_ind,
+		  ".%s", extension);
+      str_append(cmd_buf,
+		 &cmd_ind,
+		 cmd_size - cmd_ind,
+		 " -o ", 4);
+      str_append(cmd_buf,
+		 &cmd_ind,
+		 cmd_size - cmd_ind,
+		 file_buf, file_ind);
+      argv_buf[argv_ind++] = "-o";
+      argv_buf[argv_ind++] = file_buf;
+    }
+
+  if (deps && outfile_base)
+    {
+      snprintf(dep_buf, file_size + 2, "%s.d", file_buf);
+      str_write(cmd_buf,
+		&cmd_ind,
+		cmd_size - cmd_ind,
+		" -MD -MF %s", dep_buf);
+      argv_buf[argv_ind++] = "-MD";
+      argv_buf[argv_ind++] = "-MF";
+      argv_buf[argv_ind++] = dep_buf;
+    }
+  if (if_changed && outfile_base)
+    snprintf(stamp_buf, file_size + 4, "%s.cmd", file_buf);
+
+  str_append(cmd_buf,
+	     &cmd_ind,
+	     cmd_size - cmd_ind,
+	     args_frag, args_len);
+  if (preprocess_once)
+    preprocess_path(group_index(), pp_buf);
+  if (rsp_arg)
+    {
+      /* the preprocessed source is the only argument, which isn't common */
+      if (preprocess_once)
+	argv_buf[argv_ind++] = pp_buf;
+      argv_buf[argv_ind++] = rsp_arg;
+      argv_buf[argv_ind] = NULL;
+    }
+  else
+    {
+      memcpy(argv_buf + argv_ind, arguments, arg_count * sizeof(char *));
+      argv_buf[argv_ind + arg_count] = NULL;
+      if (preprocess_once)
+	argv_buf[argv_ind + pp_source] = pp_buf;
+    }
+}
+
+char *make_fragment(const char *prefix, const char *str, int *len)
+{
+  char *frag;
+
+  if (!str || !*str)
+    {
+      *len = 0;
+      return "";
+    }
+  *len = strlen(prefix) + strlen(str);
+  frag = arena_alloc(&spec_arena, *len + 1);
+  strcat(strcpy(frag, prefix), str);
+  return frag;
+}
+
+int deps_fresh(void)
+{
+  struct stat out, st;
+  char *text, *p, *dep;
+  int fresh = 1, fd;
+  ssize_t len;
+
+  if (stat(file_buf, &out) == -1 || (fd = open(dep_buf, O_RDONLY | O_CLOEXEC)) == -1)
+    return 0;
+  if (fstat(fd, &st) == -1)
+    {
+      close(fd);
+      return 0;
+    }
+  text = arena_alloc(&scratch_arena, st.st_size + 1);
+  len = read(fd, text, st.st_size);
+  close(fd);
+  if (len <= 0)
+    return 0;
+  text[len] = '\0';
+
+  /* skip "target:", then take the prerequisites of the first
+     rule: they're separated by blanks and escaped newlines, while
+     spaces in file names are escaped with backslash */
+  for (p = text; *p && !(*p == ':' && (isspace((unsigned char) p[1]) || !p[1])); ++p)
+    if (*p == '\\' && p[1])
+      ++p;
+  if (!*p)
+    fresh = 0;
+  else
+    ++p;
+  while (fresh && *p && *p != '\n')
+    {
+      if (*p == ' ' || *p == '\t' || *p == '\r')
+	{
+	  ++p;
+	  continue;
+	}
+      if (*p == '\\' && (p[1] == '\n' || (p[1] == '\r' && p[2] == '\n')))
+	{
+	  p += p[1] == '\n' ? 2 : 3;
+	  continue;
+	}
+
+      for (dep = text; *p && !isspace((unsigned char) *p); ++p)
+	if (*p == '\\' && (p[1] == ' ' || p[1] == '#' || p[1] == '\\'))
+	  *dep++ = *++p;
+	else if (*p == '$' && p[1] == '$')
+	  *dep++ = *++p;
+	else
+	  *dep++ = *p;
+      /* dependency is unescaped in place, the text before it isn't needed anymore */
+      *dep = '\0';
+
+      if (stat(text, &st) == -1 || is_newer(&st, &out))
+	fresh = 0;
+    }
+
+  return fresh;
+}
+
+int stamp_fresh(const unsigned char *hash)
+{
+  struct stat out, st;
+  char hex[2 * SHA256_LEN + 1], want[2 * SHA256_LEN + 1];
+  int i, fd;
+  ssize_t len;
+
+  if (stat(file_buf, &out) == -1 || (fd = open(stamp_buf, O_RDONLY | O_CLOEXEC)) == -1)
+    return 0;
+  len = read(fd, hex, 2 * SHA256_LEN);
+  close(fd);
+  for (i = 0; i < SHA256_LEN; ++i)
+    sprintf(want + 2 * i, "%02x", hash[i]);
+  if (len != 2 * SHA256_LEN || memcmp(hex, want, len))
+    return 0;
+
+  for (i = 0; i < arg_count; ++i)
+    if (stat(arguments[i], &st) == 0 && S_ISREG(st.st_mode) && is_newer(&st, &out))
+      return 0;
+  if (pch_header && (stat(pch_header, &st) == -1 || is_newer(&st, &out)))
+    return 0;
+  return 1;
+}
+
+void stamp_write(const char *file, const unsigned char *hash)
+{
+  char path[PATH_MAX];
+  FILE *fp;
+  int i;
+
+  snprintf(path, sizeof(path), "%s.cmd", file);
+  if (!(fp = fopen(path, "w")))
+    {
+      fprintf(stderr, "Can't write `%s': %s\n", path, strerror(errno));
+      return;
+    }
+  for (i = 0; i < SHA256_LEN; ++i)
+    fprintf(fp, "%02x", hash[i]);
+  fputc('\n', fp);
+  if (fclose(fp) == EOF)
+    fprintf(stderr, "Can't write `%s': %s\n", path, strerror(errno));
+}
+
+void command_hash(unsigned char *hash)
+{
+  struct sha256 ctx;
+  int i;
+
+  sha256_init(&ctx);
+  for (i = 0; argv_buf[i]; ++i)
+    sha256_update(&ctx, stable_arg(i), strlen(stable_arg(i)) + 1);
+  sha256_final(&ctx, hash);
+}
+
+int is_newer(const struct stat *a, const struct stat *b)
+{
+  return a -> st_mtim.tv_sec > b -> st_mtim.tv_sec
+    || (a -> st_mtim.tv_sec == b -> st_mtim.tv_sec
+	&& a -> st_mtim.tv_nsec > b -> st_mtim.tv_nsec);
+}
+
+int capture_output(char *const args[], char *buf, size_t size)
+{
+  extern char **environ;
+  posix_spawn_file_actions_t actions;
+  int fds[2], status, err;
+  size_t len = 0;
+  ssize_t n;
+  pid_t pid;
+
+  if (pipe2(fds, O_CLOEXEC) == -1)
+    return -1;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+  posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+  fflush(stdout);
+  err = posix_spawnp(&pid, args[0], &actions, &spawn_attr, args, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  close(fds[1]);
+  if (err)
+    {
+      close(fds[0]);
+      return -1;
+    }
+
+  while (len < size - 1 && ((n = read(fds[0], buf + len, size - 1 - len)) > 0
+			    || (n == -1 && errno == EINTR)))
+    if (n > 0)
+      len += n;
+  close(fds[0]);
+  buf[len] = '\0';
+  buf[strcspn(buf, "\n")] = '\0';
+
+  while (waitpid(pid, &status, 0) == -1)
+    if (errno != EINTR)
+      return -1;
+  return WIFEXITED(status) && !WEXITSTATUS(status) ? 0 : -1;
+}
+
+void tool_load(void)
+{
+  char path[PATH_MAX], line[PATH_MAX + 256], hex[2 * SHA256_LEN + 1];
+  unsigned long long dev, ino;
+  long long size, sec;
+  long nsec;
+  int i, pos;
+  unsigned int byte;
+  struct tool *t;
+  FILE *fp;
+
+  snprintf(path, PATH_MAX, "%s/toolchain", cache_dir);
+  if (!(fp = fopen(path, "r")))
+    return;
+  while (fgets(line, sizeof(line), fp))
+    {
+      line[strcspn(line, "\n")] = '\0';
+      if (sscanf(line, "%llu %llu %lld %lld %ld %64s %n",
+		 &dev, &ino, &size, &sec, &nsec, hex, &pos) != 6 || !line[pos])
+	continue;
+      if (!(t = calloc(1, sizeof(struct tool))) || !(t -> path = strdup(line + pos)))
+	errno_exit("Can't allocate tool\n");
+      t -> dev = dev;
+      t -> ino = ino;
+      t -> size = size;
+      t -> mtime.tv_sec = sec;
+      t -> mtime.tv_nsec = nsec;
+      for (i = 0; i < SHA256_LEN && sscanf(hex + 2 * i, "%2x", &byte) == 1; ++i)
+	t -> digest[i] = byte;
+      t -> next = tools;
+      tools = t;
+    }
+  fclose(fp);
+}
+
+void tool_save(void)
+{
+  char path[PATH_MAX], tmp[PATH_MAX + 32];
+  struct tool *t;
+  FILE *fp;
+  int i;
+
+  if (!tools_changed)
+    return;
+  mkdir(cache_dir, 0777);
+  snprintf(path, PATH_MAX, "%s/toolchain", cache_dir);
+  snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int) getpid());
+  if (!(fp = fopen(tmp, "w")))
+    {
+      fprintf(stderr, "Can't write `%s': %s\n", tmp, strerror(errno));
+      return;
+    }
+  for (t = tools; t; t = t -> next)
+    {
+      fprintf(fp, "%llu %llu %lld %lld %ld ",
+	      (unsigned long long) t -> dev, (unsigned long long) t -> ino,
+	      (long long) t -> size, (long long) t -> mtime.tv_sec, t -> mtime.tv_nsec);
+      for (i = 0; i < SHA256_LEN; ++i)
+	fprintf(fp, "%02x", t -> digest[i]);
+      fprintf(fp, " %s\n", t -> path);
+    }
+  if (fclose(fp) == EOF || rename(tmp, path) == -1)
+    {
+      fprintf(stderr, "Can't write `%s': %s\n", path, strerror(errno));
+      unlink(tmp);
+    }
+}
+
+int tool_digest(const char *path, unsigned char *digest)
+{
+  struct stat st;
+  struct tool *t;
+
+  if (stat(path, &st) == -1)
+    return -1;
+  for (t = tools; t && strcmp(t -> path, path); t = t -> next)
+    ;
+  if (t && t -> dev == st.st_dev && t -> ino == st.st_ino && t -> size == st.st_size
+      && t -> mtime.tv_sec == st.st_mtim.tv_sec && t -> mtime.tv_nsec == st.st_mtim.tv_nsec)
+    {
+      memcpy(digest, t -> digest, SHA256_LEN);
+      return 0;
+    }
+
+  if (sha256_file(path, digest) == -1)
+    return -1;
+  if (!t)
+    {
+      if (!(t = calloc(1, sizeof(struct tool))) || !(t -> path = strdup(path)))
+	errno_exit("Can't allocate tool\n");
+      t -> next = tools;
+      tools = t;
+    }
+  t -> dev = st.st_dev;
+  t -> ino = st.st_ino;
+  t -> size = st.st_size;
+  t -> mtime = st.st_mtim;
+  memcpy(t -> digest, digest, SHA256_LEN);
+  tools_changed = 1;
+  return 0;
+}
+
+void toolchain_hash(struct sha256 *ctx)
+{
+  static char *const progs[] = {"cc1", "cc1plus", "as", "collect2", "ld", NULL};
+  char path[PATH_MAX], query[32], *args[3];
+  unsigned char digest[SHA256_LEN];
+  const char *name;
+  int i;
+
+  if (find_program(backend, path) == -1 || tool_digest(path, digest) == -1)
+    error_exit("Can't hash backend `%s'\n", backend);
+  sha256_update(ctx, digest, SHA256_LEN);
+
+  name = strrchr(backend, '/') ? strrchr(backend, '/') + 1 : backend;
+  if (!strstr(name, "cc") && !strstr(name, "++") && !strstr(name, "clang"))
+    return;
+  for (i = 0; progs[i]; ++i)
+    {
+      snprintf(query, sizeof(query), "-print-prog-name=%s", progs[i]);
+      args[0] = backend;
+      args[1] = query;
+      args[2] = NULL;
+      /* a program, which isn't found, is printed as it is,
+	 then it's looked for in PATH, as the backend would do */
+      if (capture_output(args, path, PATH_MAX) == 0 && *path
+	  && (strchr(path, '/') || find_program(progs[i], path) == 0)
+	  && tool_digest(path, digest) == 0)
+	sha256_update(ctx, digest, SHA256_LEN);
+      else
+	sha256_update(ctx, "", 1);
+    }
+}
+
+void cache_init(void)
+{
+  struct sha256 ctx;
+  unsigned char digest[SHA256_LEN];
+  const char *name;
+  int i;
+
+  sha256_init(&ctx);
+  sha256_update(&ctx, "ccgen cache 2", 14);
+  tool_load();
+  toolchain_hash(&ctx);
+  tool_save();
+  for (i = 0; i < arg_count; ++i)
+    if (sha256_file(arguments[i], digest) == 0)
+      sha256_update(&ctx, digest, SHA256_LEN);
+    else /* not a file, only the command counts */
+      sha256_update(&ctx, "", 1);
+  if (pch_header && sha256_file(pch_header, digest) == 0)
+    sha256_update(&ctx, digest, SHA256_LEN);
+  sha256_final(&ctx, cache_base);
+
+  name = strrchr(backend, '/') ? strrchr(backend, '/') + 1 : backend;
+  if (!strstr(name, "cc") && !strstr(name, "++") && !strstr(name, "clang"))
+    return;
+  cache_pp = 1;
+  /* backend, options, -include header, -E, arguments and NULL */
+  if (!(pp_args = malloc((option_count + arg_count + 5) * sizeof(char *))))
+    errno_exit("Can't allocate preprocessing arguments\n");
+}
+
+void cache_key(unsigned char *key)
+{
+  struct sha256 ctx;
+  int i;
+
+  sha256_init(&ctx);
+  sha256_update(&ctx, cache_base, SHA256_LEN);
+  for (i = 0; argv_buf[i]; ++i)
+    if (argv_buf[i] == file_buf || argv_buf[i + 1] == file_buf /* -o file */
+	|| argv_buf[i] == dep_buf) /* -MF depfile */
+      continue;
+    else
+      sha256_update(&ctx, stable_arg(i), strlen(stable_arg(i)) + 1);
+  sha256_final(&ctx, key);
+}
+
+int cache_sources(unsigned char *key)
+{
+  const char *(*token)(const char *) = pch_header ? pch_token : pp_token;
+  unsigned char config[SHA256_LEN];
+  const char *fname;
+  struct pp_digest *d;
+  struct sha256 ctx;
+  uint64_t slot;
+  int i, argc = 0;
+
+  if (!cache_pp)
+    return 0;
+  sha256_init(&ctx);
+  for (i = 0; i < option_count; ++i)
+    {
+      fname = token(passed_options[i].opt_val[cur_set[i]].fname);
+      sha256_update(&ctx, fname, strlen(fname) + 1);
+    }
+  sha256_final(&ctx, config);
+  memcpy(&slot, config, sizeof(slot));
+  d = &pp_digests[slot % PP_DIGEST_SLOTS];
+  if (!d -> state || memcmp(d -> config, config, SHA256_LEN))
+    {
+      memcpy(d -> config, config, SHA256_LEN);
+      if (preprocess_once)
+	d -> state = sha256_file(pp_buf, d -> digest) == 0 ? 1 : -1;
+      else
+	{
+	  pp_args[argc++] = backend;
+	  /* the values of the combination, but for the ones, which don't count */
+	  for (i = 0; i < option_count; ++i)
+	    {
+	      fname = passed_options[i].opt_val[cur_set[i]].fname;
+	      if (*token(fname))
+		pp_args[argc++] = (char *) fname;
+	    }
+	  if (pch_header)
+	    {
+	      pp_args[argc++] = "-include";
+	      pp_args[argc++] = pch_header;
+	    }
+	  pp_args[argc++] = "-E";
+	  if (rsp_arg)
+	    pp_args[argc++] = rsp_arg;
+	  else
+	    {
+	      memcpy(pp_args + argc, arguments, arg_count * sizeof(char *));
+	      argc += arg_count;
+	    }
+	  pp_args[argc] = NULL;
+	  d -> state = hash_output(pp_args, d -> digest) == 0 ? 1 : -1;
+	}
+    }
+  if (d -> state == -1)
+    return -1;
+
+  sha256_init(&ctx);
+  sha256_update(&ctx, key, SHA256_LEN);
+  sha256_update(&ctx, d -> digest, SHA256_LEN);
+  sha256_final(&ctx, key);
+  return 0;
+}
+
+void cache_path(const unsigned char *key, char *path)
+{
+  int i, len;
+
+  len = snprintf(path, PATH_MAX, "%s/%02x/", cache_dir, key[0]);
+  for (i = 1; i < SHA256_LEN && len < PATH_MAX - 2; ++i)
+    len += sprintf(path + len, "%02x", key[i]);
+}
+
+int cache_fetch(const unsigned char *key, const char *file)
+{
+  char path[PATH_MAX];
+  struct stat st;
+  int hit;
+
+  cache_path(key, path);
+  if (daemon_fd != -1 && (hit = daemon_lookup(key)) != -1)
+    {
+      /* the daemon counts, and the entry is ours to make on a miss */
+      if (!hit || cache_restore(path, file) == -1)
+	return 0;
+      return 1;
+    }
+
+  if (stat(path, &st) == -1 || cache_restore(path, file) == -1)
+    {
+      ++cache_misses;
+      return 0;
+    }
+  ++cache_hits;
+  cache_touch(key, st.st_size);
+  return 1;
+}
+
+void cache_store(const unsigned char *key, const char *file)
+{
+  char path[PATH_MAX], dep[PATH_MAX], entry_dep[PATH_MAX], hex[2 * SHA256_LEN + 1];
+  struct stat st;
+
+  cache_path(key, path);
+  mkdir(cache_dir, 0777);
+  *strrchr(path, '/') = '\0';
+  mkdir(path, 0777);
+  path[strlen(path)] = '/';
+  /* the depfile goes first, the entry is there once the output is */
+  if (deps && (snprintf(dep, PATH_MAX, "%s.d", file) >= PATH_MAX
+	       || snprintf(entry_dep, PATH_MAX, "%s.d", path) >= PATH_MAX
+	       || clone_file(dep, entry_dep) == -1))
+    {
+      fprintf(stderr, "Can't cache `%s.d': %s\n", file, strerror(errno));
+      cache_abort(key);
+      return;
+    }
+  if (clone_file(file, path) == -1 || stat(path, &st) == -1)
+    {
+      fprintf(stderr, "Can't cache `%s': %s\n", file, strerror(errno));
+      cache_abort(key);
+      return;
+    }
+  ++cache_stores;
+  key_hex(key, hex);
+  if (daemon_fd == -1 || daemon_send("STORE %s %lld\n", hex, (long long) st.st_size) == -1)
+    cache_touch(key, st.st_size);
+}
+
+void cache_abort(const unsigned char *key)
+{
+  char hex[2 * SHA256_LEN + 1];
+
+  if (daemon_fd == -1)
+    return;
+  key_hex(key, hex);
+  daemon_send("ABORT %s\n", hex);
+}
+
+void key_hex(const unsigned char *key, char *hex)
+{
+  int i;
+
+  for (i = 0; i < SHA256_LEN; ++i)
+    sprintf(hex + 2 * i, "%02x", key[i]);
+}
+
+int hex_key(const char *hex, unsigned char *key)
+{
+  unsigned int byte;
+  int i;
+
+  for (i = 0; i < SHA256_LEN; ++i)
+    {
+      if (!isxdigit((unsigned char) hex[2 * i]) || !isxdigit((unsigned char) hex[2 * i + 1])
+	  || sscanf(hex + 2 * i, "%2x", &byte) != 1)
+	return -1;
+      key[i] = byte;
+    }
+  return 0;
+}
+
+int cache_restore(const char *path, const char *file)
+{
+  char dep[PATH_MAX];
+
+  if (clone_file(path, file) == -1)
+    return -1;
+  if (!deps)
+    return 0;
+  if (snprintf(dep, PATH_MAX, "%s.d", path) >= PATH_MAX)
+    return -1;
+  return depfile_restore(dep, dep_buf, file);
+}
+
+void cache_unlink(const unsigned char *key)
+{
+  char path[PATH_MAX];
+
+  cache_path(key, path);
+  unlink(path);
+  if (strlen(path) + 2 < PATH_MAX)
+    unlink(strcat(path, ".d"));
+}
+
+int depfile_restore(const char *src, const char *dst, const char *target)
+{
+  char tmp[PATH_MAX], *text, *p;
+  struct stat st;
+  int in, out, err = 0;
+  ssize_t len;
+
+  if ((in = open(src, O_RDONLY | O_CLOEXEC)) == -1)
+    return -1;
+  if (fstat(in, &st) == -1 || !(text = malloc(st.st_size + 1)))
+    {
+      close(in);
+      return -1;
+    }
+  len = read(in, text, st.st_size);
+  close(in);
+  if (len <= 0)
+    {
+      free(text);
+      return -1;
+    }
+  text[len] = '\0';
+
+  /* the target ends the way deps_fresh sees it end */
+  for (p = text; *p && !(*p == ':' && (isspace((unsigned char) p[1]) || !p[1])); ++p)
+    if (*p == '\\' && p[1])
+      ++p;
+  if (!*p || snprintf(tmp, PATH_MAX, "%s.%d.tmp", dst, (int) getpid()) >= PATH_MAX
+      || (out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)) == -1)
+    {
+      free(text);
+      return -1;
+    }
+  /* escaped the way deps_fresh unescapes it */
+  for (; *target && !err; ++target)
+    {
+      if (*target == ' ' || *target == '#' || *target == '\\')
+	err = write(out, "\\", 1) != 1 ? -1 : 0;
+      else if (*target == '$')
+	err = write(out, "$", 1) != 1 ? -1 : 0;
+      if (!err && write(out, target, 1) != 1)
+	err = -1;
+    }
+  if (write(out, p, text + len - p) != text + len - p)
+    err = -1;
+  free(text);
+  if (close(out) == -1 || err == -1 || rename(tmp, dst) == -1)
+    {
+      unlink(tmp);
+      return -1;
+    }
+  return 0;
+}
+
+int cache_lock(int op)
+{
+  int fd;
+
+  if ((fd = open(cache_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+    return -1;
+  while (flock(fd, op) == -1)
+    if (errno != EINTR)
+      {
+	close(fd);
+	return -1;
+      }
+  return fd;
+}
+
+void cache_touch(const unsigned char *key, int64_t size)
+{
+  struct cache_record rec;
+  char path[PATH_MAX];
+  int lock, fd;
+
+  memcpy(rec.key, key, SHA256_LEN);
+  rec.atime = time(NULL);
+  rec.size = size;
+  snprintf(path, PATH_MAX, "%s/index", cache_dir);
+  if ((lock = cache_lock(LOCK_SH)) == -1)
+    return;
+  /* appends of a record are atomic, so sharing the lock is fine */
+  if ((fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666)) != -1)
+    {
+      if (write(fd, &rec, sizeof(rec)) != sizeof(rec))
+	fprintf(stderr, "Can't update cache index: %s\n", strerror(errno));
+      close(fd);
+    }
+  close(lock);
+}
+
+/* @function cache_record_cmp
+
+   :::Summary:::
+   Orders records by key, the latest one first. */
+static int cache_record_cmp(const void *a, const void *b)
+{
+  const struct cache_record *x = a, *y = b;
+  int cmp = memcmp(x -> key, y -> key, SHA256_LEN);
+
+  if (cmp)
+    return cmp;
+  return (x -> atime < y -> atime) - (x -> atime > y -> atime);
+}
+
+/* @function cache_atime_cmp
+
+   :::Summary:::
+   Orders records by access time, the oldest one first. */
+static int cache_atime_cmp(const void *a, const void *b)
+{
+  const struct cache_record *x = a, *y = b;
+
+  return (x -> atime > y -> atime) - (x -> atime < y -> atime);
+}
+
+size_t cache_read_index(struct cache_record **recs, size_t *logged)
+{
+  char path[PATH_MAX];
+  struct stat st;
+  size_t n = 0, i, j;
+  ssize_t len;
+  int fd;
+
+  *recs = NULL;
+  snprintf(path, PATH_MAX, "%s/index", cache_dir);
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+    return 0;
+  if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(struct cache_record))
+    {
+      if (!(*recs = malloc(st.st_size)))
+	errno_exit("Can't allocate cache index\n");
+      if ((len = read(fd, *recs, st.st_size)) > 0)
+	n = len / sizeof(struct cache_record);
+    }
+  close(fd);
+  if (logged)
+    *logged = n;
+
+  qsort(*recs, n, sizeof(struct cache_record), cache_record_cmp);
+  for (i = j = 0; i < n; ++i)
+    if (!j || memcmp((*recs)[i].key, (*recs)[j - 1].key, SHA256_LEN))
+      (*recs)[j++] = (*recs)[i];
+  return j;
+}
+
+void cache_evict(void)
+{
+  struct cache_record *recs;
+  long long total = 0;
+  long evicted = 0;
+  size_t n, i, logged;
+  int lock;
+
+  if ((lock = cache_lock(LOCK_EX)) == -1)
+    return;
+
+  n = cache_read_index(&recs, &logged);
+  for (i = 0; i < n; ++i)
+    total += recs[i].size;
+
+  qsort(recs, n, sizeof(struct cache_record), cache_atime_cmp);
+  i = 0;
+  if (cache_max_size && total > cache_max_size)
+    /* evict somewhat more, not to do it again on the next run */
+    for (; i < n && total > cache_max_size / 100 * CACHE_LOW_WATER; ++i)
+      {
+	cache_unlink(recs[i].key);
+	total -= recs[i].size;
+	++evicted;
+      }
+  if (evicted || logged > CACHE_INDEX_SLACK * n)
+    cache_write_index(recs + i, n - i);
+  free(recs);
+  close(lock);
+  cache_add_stats(0, 0, evicted);
+}
+
+void cache_write_index(const struct cache_record *recs, size_t n)
+{
+  char path[PATH_MAX], tmp[PATH_MAX];
+  int fd;
+
+  snprintf(path, PATH_MAX, "%s/index", cache_dir);
+  snprintf(tmp, PATH_MAX, "%s/index.tmp", cache_dir);
+  if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)) != -1)
+    {
+      if (write(fd, recs, n * sizeof(struct cache_record))
+	  == (ssize_t) (n * sizeof(struct cache_record)))
+	rename(tmp, path);
+      close(fd);
+      unlink(tmp);
+    }
+}
+
+struct daemon_entry *daemon_find(const unsigned char *key, int create)
+{
+  struct daemon_entry **e;
+
+  for (e = &daemon_tab[(key[0] << 8 | key[1]) % DEDUP_BUCKETS]; *e; e = &(*e) -> next)
+    if (!memcmp((*e) -> rec.key, key, SHA256_LEN))
+      return *e;
+  if (!create)
+    return NULL;
+  if (!(*e = calloc(1, sizeof(struct daemon_entry))))
+    errno_exit("Can't allocate cache entry\n");
+  memcpy((*e) -> rec.key, key, SHA256_LEN);
+  (*e) -> owner = -1;
+  return *e;
+}
+
+void daemon_run(void)
+{
+  struct sockaddr_un addr;
+  struct cache_record *recs;
+  struct daemon_entry *e;
+  struct pollfd *fds = NULL;
+  struct timespec last;
+  struct
+  {
+    char buf[256];
+    int len;
+  } *conns = NULL;
+  char *nl;
+  size_t n, i;
+  int nfds = 1, cap = 0, fd, j, dirty = 0;
+  ssize_t len;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if ((size_t) snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/daemon.sock", cache_dir)
+      >= sizeof(addr.sun_path))
+    error_exit("Cache directory `%s' is too long for a socket\n", cache_dir);
+  mkdir(cache_dir, 0777);
+  if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+    errno_exit("Can't create socket\n");
+  if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0)
+    error_exit("The daemon of `%s' is running already\n", cache_dir);
+  unlink(addr.sun_path); /* left by a daemon, which has died */
+  if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(fd, 64) == -1)
+    errno_exit("Can't listen on `%s'\n", addr.sun_path);
+
+  n = cache_read_index(&recs, NULL);
+  for (i = 0; i < n; ++i)
+    {
+      e = daemon_find(recs[i].key, 1);
+      e -> rec = recs[i];
+      e -> present = 1;
+      daemon_total += recs[i].size;
+    }
+  free(recs);
+
+  signal(SIGINT, daemon_stop_handler);
+  signal(SIGTERM, daemon_stop_handler);
+  signal(SIGPIPE, SIG_IGN); /* a run may go away any time */
+  clock_gettime(CLOCK_MONOTONIC, &last);
+
+  for (;;)
+    {
+      if (nfds >= cap)
+	{
+	  cap = cap ? cap * 2 : 16;
+	  if (!(fds = realloc(fds, cap * sizeof(*fds))) || !(conns = realloc(conns, cap * sizeof(*conns))))
+	    errno_exit("Can't allocate connections\n");
+	}
+      fds[0].fd = fd;
+      fds[0].events = POLLIN;
+      if (poll(fds, nfds, DAEMON_SAVE_MS) == -1 && errno != EINTR)
+	errno_exit("Can't wait for requests\n");
+      if (daemon_stop)
+	break;
+
+      for (j = nfds - 1; j > 0; --j)
+	{
+	  if (!fds[j].revents)
+	    continue;
+	  len = read(fds[j].fd, conns[j].buf + conns[j].len, sizeof(conns[j].buf) - 1 - conns[j].len);
+	  if (len <= 0 && !(len == -1 && errno == EINTR))
+	    {
+	      /* the run is over */
+	      daemon_drop(fds[j].fd);
+	      close(fds[j].fd);
+	      fds[j] = fds[--nfds];
+	      conns[j] = conns[nfds];
+	      continue;
+	    }
+	  if (len < 0)
+	    continue;
+	  conns[j].len += len;
+	  conns[j].buf[conns[j].len] = '\0';
+	  while ((nl = strchr(conns[j].buf, '\n')))
+	    {
+	      *nl = '\0';
+	      daemon_request(fds[j].fd, conns[j].buf);
+	      conns[j].len -= nl + 1 - conns[j].buf;
+	      memmove(conns[j].buf, nl + 1, conns[j].len + 1);
+	      dirty = 1;
+	    }
+	  if (conns[j].len == sizeof(conns[j].buf) - 1) /* garbage */
+	    conns[j].len = 0;
+	}
+
+      if (fds[0].revents && (fds[nfds].fd = accept4(fd, NULL, NULL, SOCK_CLOEXEC)) != -1)
+	{
+	  fds[nfds].events = POLLIN;
+	  fds[nfds].revents = 0;
+	  conns[nfds++].len = 0;
+	}
+
+      if (dirty && elapsed_ms(&last) >= DAEMON_SAVE_MS)
+	{
+	  daemon_save();
+	  clock_gettime(CLOCK_MONOTONIC, &last);
+	  dirty = 0;
+	}
+    }
+
+  daemon_save();
+  unlink(addr.sun_path);
+}
+
+void daemon_request(int fd, char *line)
+{
+  unsigned char key[SHA256_LEN];
+  struct daemon_entry *e;
+  char path[PATH_MAX];
+  long long size;
+  struct stat st;
+  int i;
+
+  if (!strncmp(line, "LOOKUP ", 7) && hex_key(line + 7, key) == 0)
+    {
+      e = daemon_find(key, 1);
+      cache_path(key, path);
+      if (e -> present && stat(path, &st) == -1) /* removed behind our back */
+	{
+	  e -> present = 0;
+	  daemon_total -= e -> rec.size;
+	}
+      if (e -> present)
+	{
+	  e -> rec.atime = time(NULL);
+	  ++cache_hits;
+	  dprintf(fd, "HIT\n");
+	}
+      else if (e -> owner != -1)
+	{
+	  if (!(e -> waiters = realloc(e -> waiters, (e -> nwaiters + 1) * sizeof(int))))
+	    errno_exit("Can't allocate waiters\n");
+	  e -> waiters[e -> nwaiters++] = fd;
+	}
+      else
+	{
+	  e -> owner = fd;
+	  ++cache_misses;
+	  dprintf(fd, "MISS\n");
+	}
+    }
+  else if (!strncmp(line, "STORE ", 6) && hex_key(line + 6, key) == 0
+	   && sscanf(line + 6 + 2 * SHA256_LEN, "%lld", &size) == 1)
+    {
+      e = daemon_find(key, 1);
+      if (e -> present)
+	daemon_total -= e -> rec.size;
+      e -> present = 1;
+      e -> rec.size = size;
+      e -> rec.atime = time(NULL);
+      daemon_total += size;
+      if (e -> owner == fd)
+	e -> owner = -1;
+      for (i = 0; i < e -> nwaiters; ++i)
+	{
+	  ++cache_hits;
+	  dprintf(e -> waiters[i], "HIT\n");
+	}
+      e -> nwaiters = 0;
+      if (cache_max_size && daemon_total > cache_max_size)
+	daemon_evict();
+    }
+  else if (!strncmp(line, "ABORT ", 6) && hex_key(line + 6, key) == 0)
+    {
+      if ((e = daemon_find(key, 0)) && e -> owner == fd)
+	daemon_release(e);
+    }
+}
+
+void daemon_release(struct daemon_entry *e)
+{
+  e -> owner = -1;
+  if (!e -> nwaiters)
+    return;
+  e -> owner = e -> waiters[0];
+  memmove(e -> waiters, e -> waiters + 1, --e -> nwaiters * sizeof(int));
+  ++cache_misses;
+  dprintf(e -> owner, "MISS\n");
+}
+
+void daemon_drop(int fd)
+{
+  struct daemon_entry *e;
+  int i, j;
+
+  for (i = 0; i < DEDUP_BUCKETS; ++i)
+    for (e = daemon_tab[i]; e; e = e -> next)
+      {
+	for (j = 0; j < e -> nwaiters; )
+	  if (e -> waiters[j] == fd)
+	    e -> waiters[j] = e -> waiters[--e -> nwaiters];
+	  else
+	    ++j;
+	if (e -> owner == fd)
+	  daemon_release(e);
+      }
+}
+
+void daemon_evict(void)
+{
+  struct cache_record *recs;
+  struct daemon_entry *e;
+  size_t n = 0, i;
+
+  for (i = 0; i < DEDUP_BUCKETS; ++i)
+    for (e = daemon_tab[i]; e; e = e -> next)
+      n += e -> present;
+  if (!(recs = malloc(n * sizeof(struct cache_record) + 1)))
+    errno_exit("Can't allocate cache index\n");
+  for (n = 0, i = 0; i < DEDUP_BUCKETS; ++i)
+    for (e = daemon_tab[i]; e; e = e -> next)
+      if (e -> present)
+	recs[n++] = e -> rec;
+
+  /* evict somewhat more, not to do it again on the next store */
+  qsort(recs, n, sizeof(struct cache_record), cache_atime_cmp);
+  for (i = 0; i < n && daemon_total > cache_max_size / 100 * CACHE_LOW_WATER; ++i)
+    {
+      cache_unlink(recs[i].key);
+      daemon_find(recs[i].key, 0) -> present = 0;
+      daemon_total -= recs[i].size;
+      ++daemon_evictions;
+    }
+  free(recs);
+}
+
+void daemon_save(void)
+{
+  char path[PATH_MAX];
+  struct cache_record *recs;
+  struct daemon_entry *e;
+  struct stat st;
+  size_t n = 0, i;
+  int lock;
+
+  if ((lock = cache_lock(LOCK_EX)) == -1)
+    return;
+  n = cache_read_index(&recs, NULL);
+  for (i = 0; i < n; ++i)
+    {
+      e = daemon_find(recs[i].key, 1);
+      if (e -> present && recs[i].atime > e -> rec.atime)
+	e -> rec.atime = recs[i].atime;
+      else if (!e -> present)
+	{
+	  cache_path(recs[i].key, path);
+	  if (stat(path, &st) == -1)
+	    continue;
+	  e -> rec = recs[i];
+	  e -> present = 1;
+	  daemon_total += recs[i].size;
+	}
+    }
+  free(recs);
+
+  for (n = 0, i = 0; i < DEDUP_BUCKETS; ++i)
+    for (e = daemon_tab[i]; e; e = e -> next)
+      n += e -> present;
+  if (!(recs = malloc(n * sizeof(struct cache_record) + 1)))
+    errno_exit("Can't allocate cache index\n");
+  for (n = 0, i = 0; i < DEDUP_BUCKETS; ++i)
+    for (e = daemon_tab[i]; e; e = e -> next)
+      if (e -> present)
+	recs[n++] = e -> rec;
+  cache_write_index(recs, n);
+  close(lock);
+  free(recs);
+  cache_add_stats(cache_hits, cache_misses, daemon_evictions);
+  cache_hits = cache_misses = daemon_evictions = 0;
+}
+
+void daemon_connect(void)
+{
+  struct sockaddr_un addr;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if ((size_t) snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/daemon.sock", cache_dir)
+      >= sizeof(addr.sun_path)
+      || (daemon_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+    return;
+  if (connect(daemon_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+    {
+      close(daemon_fd);
+      daemon_fd = -1;
+    }
+}
+
+int daemon_send(const char *fmt, ...)
+{
+  char buf[128];
+  va_list ap;
+  int len;
+  ssize_t n;
+
+  va_start(ap, fmt);
+  len = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if (len < 0 || (size_t) len >= sizeof(buf))
+    return -1;
+  while ((n = send(daemon_fd, buf, len, MSG_NOSIGNAL)) == -1 && errno == EINTR)
+    ;
+  return n == len ? 0 : -1;
+}
+
+int daemon_lookup(const unsigned char *key)
+{
+  char hex[2 * SHA256_LEN + 1], reply[16];
+  int i, len = 0;
+
+  /* the daemon would have us wait for ourselves, if
+     a backend of ours is making the entry already */
+  for (;;)
+    {
+      for (i = 0; i < max_jobs; ++i)
+	if (jobs[i].pid && jobs[i].cached && !memcmp(jobs[i].key, key, SHA256_LEN))
+	  break;
+      if (i == max_jobs)
+	break;
+      reap_job(1);
+    }
+
+  key_hex(key, hex);
+  if (daemon_send("LOOKUP %s\n", hex) == -1)
+    len = -1;
+  /* the entry may be being made by another run,
+     our backends are looked after meanwhile */
+  while (len != -1 && (!len || reply[len - 1] != '\n'))
+    if (sleep_event(-1, daemon_fd))
+      {
+	if (read(daemon_fd, reply + len, 1) != 1 || ++len == sizeof(reply))
+	  len = -1;
+      }
+    else if (running_jobs)
+      while (reap_job(0))
+	;
+
+  if (len == -1)
+    {
+      fprintf(stderr, "Lost the cache daemon, going on without it\n");
+      close(daemon_fd);
+      daemon_fd = -1;
+      return -1;
+    }
+  return !strncmp(reply, "HIT\n", 4);
+}
+
+void daemon_stop_handler(int sig)
+{
+  (void) sig;
+  daemon_stop = 1;
+}
+
+void cache_add_stats(long hits, long misses, long evictions)
+{
+  char path[PATH_MAX];
+  long long stats[3] = {0, 0, 0};
+  int lock;
+  FILE *f;
+
+  snprintf(path, PATH_MAX, "%s/stats", cache_dir);
+  mkdir(cache_dir, 0777);
+  if ((lock = cache_lock(LOCK_EX)) == -1)
+    return;
+  if ((f = fopen(path, "r")))
+    {
+      if (fscanf(f, "%lld %lld %lld", &stats[0], &stats[1], &stats[2]) != 3)
+	stats[0] = stats[1] = stats[2] = 0;
+      fclose(f);
+    }
+  if ((f = fopen(path, "w")))
+    {
+      fprintf(f, "%lld %lld %lld\n", stats[0] + hits, stats[1] + misses, stats[2] + evictions);
+      fclose(f);
+    }
+  close(lock);
+}
+
+void cache_print_stats(void)
+{
+  struct cache_record *recs;
+  char path[PATH_MAX];
+  long long stats[3] = {0, 0, 0}, total = 0;
+  size_t n, i;
+  int lock;
+  FILE *f;
+
+  snprintf(path, PATH_MAX, "%s/stats", cache_dir);
+  lock = cache_lock(LOCK_SH);
+  if ((f = fopen(path, "r")))
+    {
+      if (fscanf(f, "%lld %lld %lld", &stats[0], &stats[1], &stats[2]) != 3)
+	stats[0] = stats[1] = stats[2] = 0;
+      fclose(f);
+    }
+  n = cache_read_index(&recs, NULL);
+  if (lock != -1)
+    close(lock);
+
+  for (i = 0; i < n; ++i)
+    total += recs[i].size;
+  free(recs);
+
+  printf("hits:      %lld\n"
+	 "misses:    %lld\n"
+	 "evictions: %lld\n"
+	 "entries:   %zu\n"
+	 "size:      %lld\n",
+	 stats[0], stats[1], stats[2], n, total);
+  if (stats[0] + stats[1])
+    printf("hit rate:  %.1f%%\n", 100.0 * stats[0] / (stats[0] + stats[1]));
+}
+
+int clone_file(const char *src, const char *dst)
+{
+  char tmp[PATH_MAX], buf[65536];
+  int in, out, err = 0;
+  ssize_t len;
+  struct stat st;
+
+  if (snprintf(tmp, PATH_MAX, "%s.%d.tmp", dst, (int) getpid()) >= PATH_MAX)
+    {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+  if ((in = open(src, O_RDONLY | O_CLOEXEC)) == -1)
+    return -1;
+  if (fstat(in, &st) == -1
+      || (out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 0777)) == -1)
+    {
+      close(in);
+      return -1;
+    }
+
+#ifdef FICLONE
+  if (ioctl(out, FICLONE, in) == -1)
+#endif
+    while ((len = read(in, buf, sizeof(buf))) != 0)
+      if (len == -1 ? errno != EINTR : write(out, buf, len) != len)
+	{
+	  err = -1;
+	  break;
+	}
+
+  close(in);
+  if (close(out) == -1 || err == -1 || rename(tmp, dst) == -1)
+    {
+      unlink(tmp);
+      return -1;
+    }
+  return 0;
+}
+
+int find_program(const char *name, char *path)
+{
+  const char *dirs, *end;
+  int len;
+
+  if (strchr(name, '/'))
+    return snprintf(path, PATH_MAX, "%s", name) < PATH_MAX && access(path, X_OK) == 0 ? 0 : -1;
+
+  if (!(dirs = getenv("PATH")))
+    dirs = "/bin:/usr/bin";
+  for (;; dirs = end + 1)
+    {
+      if (!(end = strchr(dirs, ':')))
+	end = dirs + strlen(dirs);
+      len = end - dirs;
+      if (snprintf(path, PATH_MAX, "%.*s%s%s", len, dirs, len ? "/" : "", name) < PATH_MAX
+	  && access(path, X_OK) == 0)
+	return 0;
+      if (!*end)
+	return -1;
+    }
+}
+
+int hash_output(char *const args[], unsigned char *digest)
+{
+  extern char **environ;
+  posix_spawn_file_actions_t actions;
+  struct sha256 ctx;
+  char buf[65536];
+  int fds[2], status, err;
+  ssize_t n;
+  pid_t pid;
+
+  if (pipe2(fds, O_CLOEXEC) == -1)
+    return -1;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+  posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+  fflush(stdout);
+  err = posix_spawnp(&pid, args[0], &actions, &spawn_attr, args, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  close(fds[1]);
+  if (err)
+    {
+      close(fds[0]);
+      return -1;
+    }
+
+  sha256_init(&ctx);
+  while ((n = read(fds[0], buf, sizeof(buf))) != 0)
+    if (n > 0)
+      sha256_update(&ctx, buf, n);
+    else if (errno != EINTR)
+      break;
+  close(fds[0]);
+  sha256_final(&ctx, digest);
+
+  while (waitpid(pid, &status, 0) == -1)
+    if (errno != EINTR)
+      return -1;
+  return !n && WIFEXITED(status) && !WEXITSTATUS(status) ? 0 : -1;
+}
+
+void sha256_init(struct sha256 *ctx)
+{
+  static const uint32_t h0[8] =
+    {
+      0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+      0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+  memcpy(ctx -> h, h0, sizeof(h0));
+  ctx -> len = 0;
+}
+
+/* @function sha256_block
+
+   :::Summary:::
+   Hashes one 64 byte block of _buf_. */
+static void sha256_block(struct sha256 *ctx)
+{
+  static const uint32_t k[64] =
+    {
+      0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+      0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+      0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+      0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+      0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+      0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+      0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+      0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+    };
+  uint32_t w[64], v[8], t1, t2;
+  int i;
+
+#define ROR(x, n) ((x) >> (n) | (x) << (32 - (n)))
+  for (i = 0; i < 16; ++i)
+    w[i] = (uint32_t) ctx -> buf[4 * i] << 24 | ctx -> buf[4 * i + 1] << 16
+      | ctx -> buf[4 * i + 2] << 8 | ctx -> buf[4 * i + 3];
+  for (; i < 64; ++i)
+    w[i] = w[i - 16] + (ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ w[i - 15] >> 3)
+      + w[i - 7] + (ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ w[i - 2] >> 10);
+
+  memcpy(v, ctx -> h, sizeof(v));
+  for (i = 0; i < 64; ++i)
+    {
+      t1 = v[7] + (ROR(v[4], 6) ^ ROR(v[4], 11) ^ ROR(v[4], 25))
+	+ ((v[4] & v[5]) ^ (~v[4] & v[6])) + k[i] + w[i];
+      t2 = (ROR(v[0], 2) ^ ROR(v[0], 13) ^ ROR(v[0], 22))
+	+ ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+      memmove(v + 1, v, 7 * sizeof(uint32_t));
+      v[4] += t1;
+      v[0] = t1 + t2;
+    }
+#undef ROR
+
+  for (i = 0; i < 8; ++i)
+    ctx -> h[i] += v[i];
+}
+
+void sha256_update(struct sha256 *ctx, const void *data, size_t len)
+{
+  const unsigned char *p = data;
+  size_t used, n;
+
+  while (len)
+    {
+      used = ctx -> len % 64;
+      n = 64 - used < len ? 64 - used : len;
+      memcpy(ctx -> buf + used, p, n);
+      ctx -> len += n;
+      p += n;
+      len -= n;
+      if (ctx -> len % 64 == 0)
+	sha256_block(ctx);
+    }
+}
+
+void sha256_final(struct sha256 *ctx, unsigned char *digest)
+{
+  uint64_t bits = ctx -> len * 8;
+  unsigned char pad[8];
+  int i;
+
+  sha256_update(ctx, "\x80", 1);
+  while (ctx -> len % 64 != 56)
+    sha256_update(ctx, "", 1);
+  for (i = 0; i < 8; ++i)
+    pad[i] = bits >> (56 - 8 * i);
+  sha256_update(ctx, pad, 8);
+  for (i = 0; i < SHA256_LEN; ++i)
+    digest[i] = ctx -> h[i / 4] >> (24 - 8 * (i % 4));
+}
+
+int sha256_file(const char *path, unsigned char *digest)
+{
+  char buf[65536];
+  ssize_t len;
+  int fd;
+  struct stat st;
+  struct sha256 ctx;
+
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+    return -1;
+  if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
+    {
+      close(fd);
+      return -1;
+    }
+  sha256_init(&ctx);
+  while ((len = read(fd, buf, sizeof(buf))) != 0)
+    if (len > 0)
+      sha256_update(&ctx, buf, len);
+    else if (errno != EINTR)
+      break;
+  close(fd);
+  sha256_final(&ctx, digest);
+  return len ? -1 : 0;
+}
+
+void print_help(const char *prog)
+{
+  printf("Usage: %s [options]... file...\n", prog);
+  printf("Options:\n"
+	 "-l <log_file>\t\t\tSend all output to <log_file>.\n"
+	 "-x <backend>\t\t\tBackend name.\n"
+	 "-j <jobs>\t\t\tRun at most <jobs> backends at once.\n"
+	 "--max-load <load>\t\tKeep load average under <load>.\n"
+	 "--max-pressure <percent>\tKeep CPU, memory and IO pressure under <percent>.\n"
+	 "--mem-limit <size>\t\tKeep predicted memory usage of backends under <size>.\n"
+	 "--history <file>\t\tLoad and save measurements of backends in <file>.\n"
+	 "--timeout <seconds>\t\tKill backends running longer than <seconds>.\n"
+	 "--fail-fast\t\t\tCancel running backends after the first failure.\n"
+	 "--keep-going\t\t\tRun all of the combinations despite failures (default).\n"
+	 "--shard <k>/<n>\t\t\tRun only the <k>-th of <n> slices of the combinations.\n"
+	 "--shard-mode <mode>\t\tSlice the combinations contiguous, strided or balanced.\n"
+	 "--cache-dir <dir>\t\tCache outputs of backends in <dir>.\n"
+	 "--cache-max-size <size>\tEvict least recently used cache entries above <size>.\n"
+	 "--cache-stats\t\t\tPrint cache statistics and exit.\n"
+	 "--daemon\t\t\tServe the cache to other runs over <dir>/daemon.sock.\n"
+	 "--deps\t\t\t\tRebuild only outputs older than their dependencies.\n"
+	 "--if-changed\t\t\tRebuild only outputs older than the arguments or made by another command.\n"
+	 "--dedup-commands\t\tRun the same commands only once, copy their outputs.\n"
+	 "--dedup-outputs mode\t\tLink identical outputs (mode is reflink or hardlink).\n"
+	 "--preprocess-once\t\tPreprocess the source once for every preprocessor configuration.\n"
+	 "--pch header\t\t\tPrecompile header once for every group of combinations, include it.\n"
+	 "--stream\t\t\tKeep memory flat, however many combinations there are.\n"
+	 "--dry-run\t\t\tPrint the commands instead of running them.\n"
+	 "--response-file <mode>\tPass common arguments in a file (auto, always or never).\n"
+	 "--emit-plan <plan>\t\tWrite the combinations into <plan> instead of running them.\n"
+	 "--run-plan <plan>\t\tRun the combinations of <plan>.\n"
+	 "-o <option_spec>\t\tOption specification.\n"
+	 "-b <base_file>\t\t\tOutput file base name.\n"
+	 "-h\t\t\t\tDisplay this help.\n"
+	 "-v\t\t\t\tDisplay version information\n");
+}
+
+void error_exit(const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+
+  exit(EXIT_FAILURE);
 }
 
 void errno_exit(const char *fmt, ...)
@@ -408,6 +5631,50 @@ void errno_exit(const char *fmt, ...)
   exit(EXIT_FAILURE);
 }
 
+void *arena_alloc(struct arena *a, size_t size)
+{
+  struct arena_block **next;
+  size_t n;
+  char *p;
+
+  size = (size + sizeof(union arena_align) - 1) / sizeof(union arena_align) * sizeof(union arena_align);
+  while (!a -> block || a -> block -> size - a -> used < size)
+    {
+      /* a block, that is too small, is skipped until the next reset */
+      next = a -> block ? &a -> block -> next : &a -> first;
+      if (!*next)
+	{
+	  n = size > ARENA_BLOCK ? size : ARENA_BLOCK;
+	  if (!(*next = malloc(sizeof(struct arena_block) + n)))
+	    errno_exit("Can't allocate %zu bytes\n", n);
+	  (*next) -> next = NULL;
+	  (*next) -> size = n;
+	}
+      a -> block = *next;
+      a -> used = 0;
+    }
+
+  p = (char *) a -> block -> data + a -> used;
+  a -> used += size;
+  return memset(p, 0, size);
+}
+
+void arena_reset(struct arena *a)
+{
+  a -> block = NULL;
+  a -> used = 0;
+}
+
+void str_append(char *str, int *ind, size_t n, const char *src, size_t len)
+{
+  if (len >= n)
+    error_exit("Attempt to buffer overflow encountered");
+
+  memcpy(str + *ind, src, len);
+  *ind += len;
+  str[*ind] = '\0';
+}
+
 void str_write(char *str, int *ind, size_t n, const char *fmt, ...)
 {
   int ch_cnt;
@@ -417,7 +5684,7 @@ void str_write(char *str, int *ind, size_t n, const char *fmt, ...)
 
   ch_cnt = vsnprintf(str + *ind, n, fmt, ap);
 
-  if (ch_cnt >= n)
+  if (ch_cnt < 0 || (size_t) ch_cnt >= n)
     error_exit("Attempt to buffer overflow encountered");
 
   *ind = *ind + ch_cnt;